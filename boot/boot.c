@@ -0,0 +1,311 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <avr/boot.h>
+#include <avr/eeprom.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#include <util/crc16.h>
+#include <util/delay.h>
+#include "../src/storage.h"
+
+/*
+  UART bootloader in the 1 KB boot section. The application ends at
+  BOOT_START, the fuses must select BOOTSZ = 01 and program BOOTRST.
+
+  A valid application is started at once, unless it requested an update in
+  BOOT_REQUEST or the host holds RXD low during reset. Then the host has a
+  few seconds to send SYNC, which is answered with ACK. Then it sends frames
+  of FRAME_SIZE bytes: the type, the page number, SPM_PAGESIZE bytes and a
+  CRC16 over all of them. A page frame is answered with ACK as soon as its
+  page is being programmed, so the next page is received while the flash is
+  busy. The end frame carries the number of pages in the page field and the
+  CRC16 of the whole image in its first two data bytes. It is answered with
+  ACK once the image has been verified, and the application is started. If
+  the host stays silent for a few seconds, a valid application is started as
+  well.
+*/
+
+#define BOOT_START       0x1C00
+#define PAGES            (BOOT_START / SPM_PAGESIZE)
+
+#define BAUD             250000UL
+#define UBRR             (F_CPU / (8 * BAUD) - 1)
+
+#define SYNC             0x1B
+#define ACK              0x06
+#define NAK              0x15
+
+#define FRAME_PAGE       'P'
+#define FRAME_END        'E'
+
+#define TICKS_PER_SECOND (F_CPU / 1024)
+#define TIMEOUT_UPDATE   (TICKS_PER_SECOND * 4)
+#define TIMEOUT_IDLE     (TICKS_PER_SECOND * 4)
+#define TIMEOUT_BYTE     (TICKS_PER_SECOND / 50)
+#define TIMEOUT_BREAK    UINT16_MAX
+
+#define RXD_PORT         PORTD
+#define RXD_INPUT        PIND
+#define RXD_PIN          PD0
+#define PULL_UP_US       10
+
+#define IMAGE_UNKNOWN    0xFF
+
+typedef struct {
+  uint8_t type;
+  uint8_t page;
+  uint8_t data[SPM_PAGESIZE];
+  uint16_t crc;
+} frame_t;
+
+typedef struct {
+  uint8_t pages;
+  uint16_t crc;
+} image_t;
+
+typedef char check_image_size[sizeof(image_t) <= BOOT_REQUEST - BOOT_ADDRESS ? 1 : -1];
+
+static frame_t frames[2];
+static frame_t* programming = NULL;
+static frame_t* pending = NULL;
+static bool writing = false;
+static bool invalidated = false;
+
+static void sendByte(uint8_t c) {
+  loop_until_bit_is_set(UCSR0A, UDRE0);
+  UDR0 = c;
+}
+
+static uint16_t getFrameCrc(const frame_t* frame) {
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < offsetof(frame_t, crc); i += 1) {
+    crc = _crc16_update(crc, ((const uint8_t*) frame)[i]);
+  }
+  return crc;
+}
+
+static uint16_t getImageCrc(uint8_t pages) {
+  uint16_t crc = 0xFFFF;
+  for (uint16_t address = 0; address < pages * SPM_PAGESIZE; address += 1) {
+    crc = _crc16_update(crc, pgm_read_byte(address));
+  }
+  return crc;
+}
+
+/*
+  An image without a record was programmed with an ISP programmer and is
+  trusted if it is not erased. An update that did not complete leaves zero
+  pages in the record. The CRC of an update is checked once by handleEnd
+  before the record is written, not on every reset.
+*/
+static bool isImageValid(void) {
+  image_t image;
+  eeprom_read_block(&image, (void*) BOOT_ADDRESS, sizeof(image));
+  if (image.pages == IMAGE_UNKNOWN) {
+    return pgm_read_word(0) != 0xFFFF;
+  }
+  return image.pages && image.pages <= PAGES;
+}
+
+/*
+  A host can hold RXD low during reset to enter the bootloader, even if the
+  application does not handle the update command.
+*/
+static bool isBreak(void) {
+  RXD_PORT |= _BV(RXD_PIN);
+  _delay_us(PULL_UP_US);
+  return bit_is_clear(RXD_INPUT, RXD_PIN);
+}
+
+static bool isUpdateRequested(void) {
+  if (eeprom_read_byte((uint8_t*) BOOT_REQUEST) != BOOT_REQUEST_UPDATE) {
+    return false;
+  }
+  eeprom_write_byte((uint8_t*) BOOT_REQUEST, 0xFF);
+  return true;
+}
+
+/*
+  The reset cause is passed in GPIOR0, because MCUSR has to be cleared here
+  to keep the watchdog from resetting the bootloader.
+*/
+static void startApplication(uint8_t resetCause) {
+  UCSR0B = 0;
+  UCSR0A = 0;
+  UBRR0 = 0;
+  TCCR1B = 0;
+  TCNT1 = 0;
+  RXD_PORT &= ~_BV(RXD_PIN);
+  GPIOR0 = resetCause;
+  ((void (*)(void)) 0)();
+}
+
+static bool waitForSync(uint16_t timeout) {
+  TCNT1 = 0;
+  while (TCNT1 < timeout) {
+    if (bit_is_set(UCSR0A, RXC0) && UDR0 == SYNC) {
+      sendByte(ACK);
+      TCNT1 = 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+  Loads the temporary page buffer and starts erasing the page. handleFlash
+  writes it once the erase is done, while the next frame is received.
+*/
+static void startPage(frame_t* frame) {
+  uint16_t address = frame->page * SPM_PAGESIZE;
+  for (uint8_t i = 0; i < SPM_PAGESIZE; i += 2) {
+    boot_page_fill_safe(address + i, frame->data[i] | (frame->data[i + 1] << 8));
+  }
+  boot_page_erase_safe(address);
+  programming = frame;
+  writing = false;
+  sendByte(ACK);
+}
+
+static void handleFlash(void) {
+  if (!programming || boot_spm_busy()) {
+    return;
+  }
+  if (!writing) {
+    boot_page_write(programming->page * SPM_PAGESIZE);
+    writing = true;
+    return;
+  }
+  boot_rww_enable();
+  programming = NULL;
+  if (pending) {
+    startPage(pending);
+    pending = NULL;
+  }
+}
+
+/*
+  Returns true if the frame buffer is in use until the page is programmed.
+*/
+static bool handlePage(frame_t* frame) {
+  if (frame->page >= PAGES || pending) {
+    sendByte(NAK);
+    return false;
+  }
+  if (!invalidated) {
+    eeprom_update_byte((uint8_t*) BOOT_ADDRESS + offsetof(image_t, pages), 0);
+    invalidated = true;
+  }
+  if (programming) {
+    pending = frame;
+  } else {
+    startPage(frame);
+  }
+  return true;
+}
+
+static void handleEnd(frame_t* frame, uint8_t resetCause) {
+  while (programming) {
+    handleFlash();
+  }
+  image_t image = {
+    .pages = frame->page,
+    .crc = frame->data[0] | (frame->data[1] << 8),
+  };
+  if (!image.pages || image.pages > PAGES || getImageCrc(image.pages) != image.crc) {
+    sendByte(NAK);
+    return;
+  }
+  eeprom_update_block(&image, (void*) BOOT_ADDRESS, sizeof(image));
+  eeprom_busy_wait();
+  sendByte(ACK);
+  loop_until_bit_is_set(UCSR0A, TXC0);
+  startApplication(resetCause);
+}
+
+int main(void) {
+  uint8_t resetCause = MCUSR;
+  MCUSR = 0;
+  wdt_disable();
+
+  bool held = isBreak();
+  if (!isUpdateRequested() && !held && isImageValid()) {
+    startApplication(resetCause);
+  }
+
+  /* 250000 baud is marginal on the uncalibrated RC oscillator */
+  uint8_t calibration = eeprom_read_byte((uint8_t*) OSCCAL_ADDRESS);
+  if (calibration && calibration != 0xFF) {
+    OSCCAL = calibration;
+  }
+  UBRR0 = UBRR;
+  UCSR0A = _BV(U2X0) | _BV(TXC0);
+  UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+  UCSR0B = _BV(RXEN0) | _BV(TXEN0);
+  TCCR1B = _BV(CS12) | _BV(CS10);
+
+  if (held) {
+    TCNT1 = 0;
+    while (bit_is_clear(RXD_INPUT, RXD_PIN) && TCNT1 < TIMEOUT_BREAK);
+  }
+  if (!waitForSync(TIMEOUT_UPDATE)) {
+    if (isImageValid()) {
+      startApplication(resetCause);
+    }
+    while (!waitForSync(UINT16_MAX));
+  }
+
+  frame_t* frame = &frames[0];
+  uint8_t received = 0;
+  for (;;) {
+    handleFlash();
+    if (TCNT1 > TIMEOUT_IDLE && isImageValid()) {
+      startApplication(resetCause);
+    }
+    if (received && TCNT1 > TIMEOUT_BYTE) {
+      received = 0;
+      sendByte(NAK);
+    }
+    if (bit_is_clear(UCSR0A, RXC0)) {
+      continue;
+    }
+    uint8_t c = UDR0;
+    TCNT1 = 0;
+    if (!received && c == SYNC) {
+      continue;
+    }
+    ((uint8_t*) frame)[received++] = c;
+    if (received < sizeof(frame_t)) {
+      continue;
+    }
+    received = 0;
+    if (frame->crc != getFrameCrc(frame)) {
+      sendByte(NAK);
+    } else if (frame->type == FRAME_PAGE) {
+      if (handlePage(frame)) {
+        frame = frame == &frames[0] ? &frames[1] : &frames[0];
+      }
+    } else if (frame->type == FRAME_END) {
+      handleEnd(frame, resetCause);
+    } else {
+      sendByte(NAK);
+    }
+  }
+}
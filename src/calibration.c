@@ -0,0 +1,89 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdint.h>
+#include <avr/io.h>
+#include "calibration.h"
+
+#define COUNTS_PER_TICK   10001L
+#define COUNTS_PER_SECOND (F_CPU / 8)
+#define MINIMUM_TICKS     90
+#define MAXIMUM_TICKS     110
+#define TOLERANCE         2000L
+#define SAMPLES           4
+#define STABLE_ROUNDS     3
+#define OSCCAL_STEPS      0x7F
+
+/*
+  Timer1 counts F_CPU / 8, so one second of the DS1307 square wave should
+  measure F_CPU / 8 counts. The error is averaged over a few seconds and
+  OSCCAL is moved by one step at a time until it stays within the tolerance.
+  The tolerance is about as large as one OSCCAL step, so a step back against
+  the previous one needs twice the error, which keeps OSCCAL from toggling
+  between two values that are both close. OSCCAL never leaves its range,
+  because the two ranges overlap and the frequency jumps between them. The
+  calibration is only reported for storing after it has been stable for a
+  few rounds. Intervals which are far off, e.g. because Timer1 was stopped in
+  power-save mode, are discarded.
+*/
+static uint16_t previousCount;
+static int32_t error;
+static uint8_t samples;
+static int8_t direction = 0;
+static uint8_t stableRounds = 0;
+static uint8_t calibration = 0;
+
+void calibrateOscillator(uint8_t ticks, uint16_t count) {
+  if (ticks < MINIMUM_TICKS || ticks > MAXIMUM_TICKS) {
+    previousCount = count;
+    samples = 0;
+    error = 0;
+    return;
+  }
+
+  error += ticks * COUNTS_PER_TICK + count - previousCount - COUNTS_PER_SECOND;
+  previousCount = count;
+  samples += 1;
+  if (samples < SAMPLES) {
+    return;
+  }
+
+  uint8_t value = OSCCAL;
+  int8_t step = 0;
+  if (error > TOLERANCE * SAMPLES * (direction > 0 ? 2 : 1) && (value & OSCCAL_STEPS) != 0) {
+    step = -1;
+  } else if (error < -TOLERANCE * SAMPLES * (direction < 0 ? 2 : 1) && (value & OSCCAL_STEPS) != OSCCAL_STEPS) {
+    step = 1;
+  }
+  if (step) {
+    OSCCAL = value + step;
+    direction = step;
+    stableRounds = 0;
+    calibration = 0;
+  } else {
+    if (stableRounds < STABLE_ROUNDS) {
+      stableRounds += 1;
+    }
+    if (stableRounds == STABLE_ROUNDS) {
+      calibration = value;
+    }
+  }
+  samples = 0;
+  error = 0;
+}
+
+uint8_t getCalibration(void) {
+  return calibration;
+}
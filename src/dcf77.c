@@ -145,3 +145,7 @@ void initDcf77() {
 void disableDcf77() {
   DCF77_PON_DDR &= ~_BV(DCF77_PON_PIN);
 }
+
+bool isDcf77Enabled() {
+  return bit_is_set(DCF77_PON_DDR, DCF77_PON_PIN);
+}
@@ -26,4 +26,6 @@ bool trackDcf77(time_t* time);
 
 void disableDcf77();
 
+bool isDcf77Enabled();
+
 #endif
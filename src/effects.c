@@ -0,0 +1,97 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "effects.h"
+#include "matrix.h"
+
+#define PHASE_MAXIMUM 0xFF
+
+typedef struct {
+  uint8_t rate;
+  uint8_t last;
+  uint8_t soft;
+} effect_t;
+
+/* The typewriter numbers the cells in last, and its end must fit progress. */
+typedef char check_cell_count[ROWS * COLUMNS < UINT8_MAX ? 1 : -1];
+
+/*
+  Each effect assigns every cell a position. The progress runs from zero to
+  past the last position in 8.8 fixed point, advancing by rate per transition
+  step, and a cell switches to the new frame when the progress passes its
+  position. Soft effects fade a cell over one position, the others switch it
+  at once. Computing a phase takes a few shifts and one 8 bit multiply and
+  no loops, so a step costs the same for every effect.
+*/
+static const effect_t effects[EFFECTS] PROGMEM = {
+  { 0, 0, 0 },
+  { 26, COLUMNS, 1 },
+  { 64, ROWS * COLUMNS, 0 },
+  { 22, ROWS + 8, 1 },
+  { 41, 32, 0 },
+};
+
+static uint8_t effect = EFFECT_NONE;
+static uint16_t progress;
+static uint16_t end;
+
+static uint8_t getHash(uint8_t row, uint8_t column) {
+  return (uint8_t) (row * COLUMNS + column) * 167 + 13;
+}
+
+static uint8_t getPosition(uint8_t row, uint8_t column) {
+  if (effect == EFFECT_WIPE) {
+    return column;
+  } else if (effect == EFFECT_TYPEWRITER) {
+    return row * COLUMNS + column;
+  } else if (effect == EFFECT_RAIN) {
+    return row + (getHash(0, column) >> 5);
+  } else {
+    return getHash(row, column) >> 3;
+  }
+}
+
+void startEffect(uint8_t type) {
+  effect = type < EFFECTS ? type : EFFECT_NONE;
+  progress = 0;
+  end = (uint16_t) (pgm_read_byte(&effects[effect].last) + 1) << 8;
+}
+
+bool isEffectRunning(void) {
+  return effect != EFFECT_NONE;
+}
+
+void advanceEffect(void) {
+  if (effect == EFFECT_NONE) {
+    return;
+  }
+  progress += pgm_read_byte(&effects[effect].rate);
+  if (progress >= end) {
+    effect = EFFECT_NONE;
+  }
+}
+
+uint8_t getEffectPhase(uint8_t row, uint8_t column) {
+  uint16_t position = (uint16_t) getPosition(row, column) << 8;
+  if (progress < position) {
+    return 0;
+  } else if (!pgm_read_byte(&effects[effect].soft) || progress - position > PHASE_MAXIMUM) {
+    return PHASE_MAXIMUM;
+  }
+  return progress - position;
+}
@@ -0,0 +1,37 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef __EFFECTS_H_
+#define __EFFECTS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define EFFECT_NONE       0
+#define EFFECT_WIPE       1
+#define EFFECT_TYPEWRITER 2
+#define EFFECT_RAIN       3
+#define EFFECT_SPARKLE    4
+#define EFFECTS           5
+
+void startEffect(uint8_t effect);
+
+bool isEffectRunning(void);
+
+void advanceEffect(void);
+
+uint8_t getEffectPhase(uint8_t row, uint8_t column);
+
+#endif
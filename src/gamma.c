@@ -17,265 +17,46 @@
 #include <avr/pgmspace.h>
 #include "gamma.h"
 
-const uint16_t gammaValues[256] PROGMEM = {
-  0,
-  0,
-  0,
-  0,
-  0,
-  0,
-  1,
-  1,
-  2,
-  2,
-  3,
-  4,
-  4,
-  5,
-  6,
-  8,
-  9,
-  10,
-  12,
-  13,
-  15,
-  16,
-  18,
-  20,
-  22,
-  24,
-  26,
-  29,
-  31,
-  34,
-  36,
-  39,
-  42,
-  45,
-  48,
-  51,
-  55,
-  58,
-  62,
-  65,
-  69,
-  73,
-  77,
-  81,
-  85,
-  90,
-  94,
-  99,
-  103,
-  108,
-  113,
-  118,
-  123,
-  129,
-  134,
-  140,
-  145,
-  151,
-  157,
-  163,
-  169,
-  176,
-  182,
-  189,
-  195,
-  202,
-  209,
-  216,
-  223,
-  230,
-  238,
-  245,
-  253,
-  261,
-  269,
-  277,
-  285,
-  293,
-  302,
-  310,
-  319,
-  328,
-  337,
-  346,
-  355,
-  365,
-  374,
-  384,
-  394,
-  404,
-  414,
-  424,
-  434,
-  445,
-  455,
-  466,
-  477,
-  488,
-  499,
-  510,
-  522,
-  533,
-  545,
-  557,
-  569,
-  581,
-  593,
-  606,
-  618,
-  631,
-  644,
-  657,
-  670,
-  683,
-  696,
-  710,
-  724,
-  737,
-  751,
-  765,
-  780,
-  794,
-  809,
-  823,
-  838,
-  853,
-  868,
-  883,
-  899,
-  914,
-  930,
-  946,
-  962,
-  978,
-  994,
-  1010,
-  1027,
-  1044,
-  1060,
-  1077,
-  1095,
-  1112,
-  1129,
-  1147,
-  1165,
-  1182,
-  1201,
-  1219,
-  1237,
-  1255,
-  1274,
-  1293,
-  1312,
-  1331,
-  1350,
-  1369,
-  1389,
-  1409,
-  1428,
-  1448,
-  1469,
-  1489,
-  1509,
-  1530,
-  1551,
-  1571,
-  1592,
-  1614,
-  1635,
-  1656,
-  1678,
-  1700,
-  1722,
-  1744,
-  1766,
-  1789,
-  1811,
-  1834,
-  1857,
-  1880,
-  1903,
-  1926,
-  1950,
-  1974,
-  1997,
-  2021,
-  2045,
-  2070,
-  2094,
-  2119,
-  2144,
-  2168,
-  2193,
-  2219,
-  2244,
-  2270,
-  2295,
-  2321,
-  2347,
-  2373,
-  2400,
-  2426,
-  2453,
-  2480,
-  2507,
-  2534,
-  2561,
-  2588,
-  2616,
-  2644,
-  2672,
-  2700,
-  2728,
-  2756,
-  2785,
-  2814,
-  2842,
-  2871,
-  2901,
-  2930,
-  2960,
-  2989,
-  3019,
-  3049,
-  3079,
-  3110,
-  3140,
-  3171,
-  3202,
-  3233,
-  3264,
-  3295,
-  3326,
-  3358,
-  3390,
-  3422,
-  3454,
-  3486,
-  3519,
-  3551,
-  3584,
-  3617,
-  3650,
-  3683,
-  3717,
-  3750,
-  3784,
-  3818,
-  3852,
-  3886,
-  3921,
-  3955,
-  3990,
-  4025,
-  4060,
-  4095,
-};
+/*
+  The table is generated by tools/gamma.py from the GAMMA parameters in the
+  Makefile.
+*/
+#include "gamma_table.h"
+
+typedef char check_gamma_bits[GAMMA_INPUT_BITS == 8 && GAMMA_BITS > 8 && GAMMA_BITS <= 12 ? 1 : -1];
+
+static uint8_t gammaCurve = GAMMA_CURVE_DEFAULT;
+static uint8_t gammaShift = 0;
+static uint16_t gammaMaximum = (1 << GAMMA_BITS) - 1;
+
+void setGammaCurve(uint8_t curve) {
+  gammaCurve = curve;
+}
 
+/*
+  The maximum is the largest value the matrix shows in full at that depth.
+*/
+void setGammaRange(uint8_t bits, uint16_t maximum) {
+  gammaShift = bits < GAMMA_BITS ? GAMMA_BITS - bits : 0;
+  gammaMaximum = maximum;
+}
+
+/*
+  Values for a smaller output depth are rounded up, so that the lowest steps
+  of the curve stay visible. All values are clipped to the maximum.
+*/
 uint16_t getGammaValue(uint8_t index) {
-  return pgm_read_word(&gammaValues[index]);
+  uint16_t value;
+  if (gammaCurve == GAMMA_CURVE_LINEAR) {
+    value = (index << (GAMMA_BITS - 8)) | (index >> (16 - GAMMA_BITS));
+  } else {
+    value = pgm_read_word(&gammaValues[index]);
+  }
+  if (gammaShift) {
+    value = (value + (1 << gammaShift) - 1) >> gammaShift;
+  }
+  if (value > gammaMaximum) {
+    value = gammaMaximum;
+  }
+  return value;
 }
@@ -18,6 +18,13 @@
 
 #include <stdint.h>
 
+#define GAMMA_CURVE_DEFAULT 0
+#define GAMMA_CURVE_LINEAR  1
+
+void setGammaCurve(uint8_t curve);
+
+void setGammaRange(uint8_t bits, uint16_t maximum);
+
 uint16_t getGammaValue(uint8_t index);
 
 #endif
@@ -0,0 +1,124 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdint.h>
+#include <avr/eeprom.h>
+#include <util/atomic.h>
+#include "log.h"
+#include "storage.h"
+#include "time.h"
+#include "uart.h"
+
+#define ENTRY_SIZE  8
+#define ENTRIES     (LOG_SIZE / ENTRY_SIZE)
+
+#define QUEUE_SIZE  4
+
+#define CRLF        "\r\n"
+
+typedef struct {
+  uint8_t type;
+  uint16_t value;
+} event_t;
+
+/*
+  Events are queued in RAM by logEvent, which is safe to call from an ISR, and
+  written to EEPROM one byte per flushLog call so that the main loop never waits
+  for the EEPROM. The log is a ring of 8 byte entries; consecutive entries carry
+  consecutive sequence numbers, so the oldest entry is the one following the
+  first gap in the sequence. The sequence number is written last to commit an
+  entry.
+*/
+static volatile event_t queue[QUEUE_SIZE];
+static volatile uint8_t queue_head = 0;
+static volatile uint8_t queue_tail = 0;
+
+static uint8_t entry[ENTRY_SIZE];
+static uint8_t entry_pos = 0;
+static uint8_t log_head;
+static uint8_t sequence;
+
+static uint8_t* getEntryAddress(uint8_t index) {
+  return (uint8_t*) (LOG_ADDRESS + index * ENTRY_SIZE);
+}
+
+void initLog(void) {
+  for (uint8_t i = 0; i < ENTRIES; i += 1) {
+    uint8_t next = (i + 1) % ENTRIES;
+    uint8_t current_sequence = eeprom_read_byte(getEntryAddress(i));
+    if (eeprom_read_byte(getEntryAddress(next)) != (uint8_t) (current_sequence + 1)) {
+      log_head = next;
+      sequence = current_sequence + 1;
+      break;
+    }
+  }
+}
+
+void logEvent(uint8_t type, uint16_t value) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    uint8_t tmp_head = (queue_head + 1) % QUEUE_SIZE;
+    if (tmp_head != queue_tail) {
+      queue[queue_head].type = type;
+      queue[queue_head].value = value;
+      queue_head = tmp_head;
+    }
+  }
+}
+
+void flushLog(const time_t* time) {
+  if (!eeprom_is_ready()) {
+    return;
+  }
+
+  if (entry_pos == 0) {
+    if (queue_head == queue_tail) {
+      return;
+    }
+    entry[0] = sequence;
+    entry[1] = queue[queue_tail].type;
+    entry[2] = time->day;
+    entry[3] = time->hours;
+    entry[4] = time->minutes;
+    entry[5] = time->seconds;
+    entry[6] = queue[queue_tail].value >> 8;
+    entry[7] = queue[queue_tail].value;
+    queue_tail = (queue_tail + 1) % QUEUE_SIZE;
+    entry_pos = 1;
+  }
+
+  uint8_t* address = getEntryAddress(log_head);
+  if (entry_pos < ENTRY_SIZE) {
+    eeprom_update_byte(address + entry_pos, entry[entry_pos]);
+    entry_pos += 1;
+  } else {
+    eeprom_update_byte(address, entry[0]);
+    sequence += 1;
+    log_head = (log_head + 1) % ENTRIES;
+    entry_pos = 0;
+  }
+}
+
+void dumpLog(void) {
+  for (uint8_t i = 0; i < ENTRIES; i += 1) {
+    uint8_t* address = getEntryAddress((log_head + i) % ENTRIES);
+    if (eeprom_read_byte(address + 1) == 0xFF) {
+      continue;
+    }
+    uart_puts(CRLF);
+    for (uint8_t j = 0; j < ENTRY_SIZE; j += 1) {
+      uart_puthex(eeprom_read_byte(address + j));
+    }
+  }
+}
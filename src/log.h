@@ -0,0 +1,37 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef __LOG_H_
+#define __LOG_H_
+
+#include <stdint.h>
+#include "time.h"
+
+#define LOG_BOOT          0x01
+#define LOG_DCF77_SYNC    0x02
+#define LOG_TWI_ERROR     0x03
+#define LOG_UART_OVERFLOW 0x04
+#define LOG_BRIGHTNESS    0x05
+#define LOG_THERMAL       0x06
+
+void initLog(void);
+
+void logEvent(uint8_t type, uint16_t value);
+
+void flushLog(const time_t* time);
+
+void dumpLog(void);
+
+#endif
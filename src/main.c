@@ -13,300 +13,285 @@
    See the License for the specific language governing permissions and
    limitations under the License.
 */
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <avr/eeprom.h>
 #include <avr/interrupt.h>
 #include <avr/io.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
 #include <util/delay.h>
+#include "calibration.h"
 #include "dcf77.h"
+#include "effects.h"
 #include "gamma.h"
+#include "log.h"
 #include "matrix.h"
+#include "phrases.h"
+#include "profile.h"
 #include "rtc.h"
+#include "schedule.h"
+#include "settings.h"
+#include "stack.h"
+#include "storage.h"
+#include "sync.h"
 #include "time.h"
 #include "uart.h"
 
+#define HOURS_PER_DAY      24
 #define MINUTES_PER_HOUR   60
+#define SECONDS_PER_MINUTE 60
+#define US_PER_TICK        10000UL
+#define SQUARE_WAVE_TIMEOUT 200
 
 #define MINIMUM_BRIGHTNESS 0x00
 #define MAXIMUM_BRIGHTNESS 0xFF
 
 #define TRANSITION_DELAY   5
 
+#define DOTS_OFF           0
+#define DOTS_MINUTES       1
+#define DOTS_SECONDS       2
+
+#define DOTS_ROW           0
+#define MINUTE_DOTS        4
+#define MINUTE_DOT_CHANNEL COLUMNS
+#define SECONDS_CHANNEL    (COLUMNS + MINUTE_DOTS)
+#define SECONDS_PULSE      50
+
+#define FADE_IN_STEP       16
+#define MAXIMUM_FADE       0xFF
+
 #define COMMAND_VERSION    'v'
 #define COMMAND_BRIGHTNESS 'b'
 #define COMMAND_TIME       't'
+#define COMMAND_LOG        'l'
+#define COMMAND_SETTING    's'
+#define COMMAND_REFRESH    'r'
+#define COMMAND_EFFECT     'e'
+#define COMMAND_RULE       'a'
+#define COMMAND_PROFILE    'p'
+#define COMMAND_MEMORY     'm'
+#define COMMAND_FAULTS     'f'
+#define COMMAND_UPDATE     'u'
 
 #define CR                 '\r'
 #define LF                 '\n'
 #define CRLF               "\r\n"
 
-#define ARGUMENT_BUFFER_SIZE 12
-
-uint16_t minuteData[12][4] = {
-  {
-    0b11011100000,
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-  },
-  {
-    0b11011101111,
-    0b00000000000,
-    0b00000000000,
-    0b11110000000,
-  },
-  {
-    0b11011100000,
-    0b00000001111,
-    0b00000000000,
-    0b11110000000,
-  },
-  {
-    0b11011100000,
-    0b11111110000,
-    0b00000000000,
-    0b11110000000,
-  },
-  {
-    0b11011100000,
-    0b00000000000,
-    0b11111110000,
-    0b11110000000,
-  },
-  {
-    0b11011101111,
-    0b00000000000,
-    0b00000000111,
-    0b00000001111,
-  },
-  {
-    0b11011100000,
-    0b00000000000,
-    0b00000000000,
-    0b00000001111,
-  },
-  {
-    0b11011101111,
-    0b00000000000,
-    0b00000000000,
-    0b11110001111,
-  },
-  {
-    0b11011100000,
-    0b00000000000,
-    0b11111110111,
-    0b00000000000,
-  },
-  {
-    0b11011100000,
-    0b11111110000,
-    0b00000000111,
-    0b00000000000,
-  },
-  {
-    0b11011100000,
-    0b00000001111,
-    0b00000000111,
-    0b00000000000,
-  },
-  {
-    0b11011101111,
-    0b00000000000,
-    0b00000000111,
-    0b00000000000,
-  },
-};
+#define ARGUMENT_BUFFER_SIZE 18
 
-uint16_t hourData[12][5] = {
-  {
-    0b00000000000,
-    0b00000000000,
-    0b00011111000,
-    0b00000000000,
-    0b00000000000,
-  },
-  {
-    0b00111100000,
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-  },
-  {
-    0b11110000000,
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-  },
-  {
-    0b00000011110,
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-  },
-  {
-    0b00000000000,
-    0b11110000000,
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-  },
-  {
-    0b00000000000,
-    0b00000000000,
-    0b00000001111,
-    0b00000000000,
-    0b00000000000,
-  },
-  {
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-    0b01111100000,
-    0b00000000000,
-  },
-  {
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-    0b00000111111,
-    0b00000000000,
-  },
-  {
-    0b00000000000,
-    0b00000001111,
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-  },
-  {
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-    0b00011110000,
-  },
-  {
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-    0b11110000000,
-  },
-  {
-    0b00000000000,
-    0b00000000000,
-    0b11100000000,
-    0b00000000000,
-    0b00000000000,
-  },
-};
+#define WATCHDOG_CHECK_TICKS 50
+
+#define FAULT_MATRIX       0
+#define FAULT_TWI          1
+#define FAULT_UART         2
 
-uint16_t fullHourData[12][5] = {
-  {
-    0b00000000000,
-    0b00000000000,
-    0b00011111000,
-    0b00000000000,
-    0b00000000111,
-  },
-  {
-    0b00111000000,
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-    0b00000000111,
-  },
-  {
-    0b11110000000,
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-    0b00000000111,
-  },
-  {
-    0b00000011110,
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-    0b00000000111,
-  },
-  {
-    0b00000000000,
-    0b11110000000,
-    0b00000000000,
-    0b00000000000,
-    0b00000000111,
-  },
-  {
-    0b00000000000,
-    0b00000000000,
-    0b00000001111,
-    0b00000000000,
-    0b00000000111,
-  },
-  {
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-    0b01111100000,
-    0b00000000111,
-  },
-  {
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-    0b00000111111,
-    0b00000000111,
-  },
-  {
-    0b00000000000,
-    0b00000001111,
-    0b00000000000,
-    0b00000000000,
-    0b00000000111,
-  },
-  {
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-    0b00011110111,
-  },
-  {
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-    0b00000000000,
-    0b11110000111,
-  },
-  {
-    0b00000000000,
-    0b00000000000,
-    0b11100000000,
-    0b00000000000,
-    0b00000000111,
-  },
+#define HOST_TIMEOUT       60
+
+const time_t defaultTime = {
+  .year = 13,
+  .month = 1,
+  .day = 1,
+  .hours = 10,
+  .minutes = 0,
+  .seconds = 0,
 };
 
 volatile uint8_t maximum_brightness = MAXIMUM_BRIGHTNESS;
-time_t time;
+volatile bool redraw = false;
+volatile uint8_t ticks = 0;
+volatile uint16_t tickStart = 0;
+volatile uint32_t clockTicks = 0;
+volatile bool squareWave = false;
+volatile bool readPending = false;
+volatile uint8_t watchdogTicks = 0;
+volatile uint8_t hostSeconds = 0;
+uint8_t resetCause __attribute__ ((section (".noinit")));
+uint8_t watchdogFaults __attribute__ ((section (".noinit")));
+bool synced = false;
 
+/*
+  The time is only written from ISRs, which run to completion, or with
+  interrupts disabled, and every write increments timeSequence. The main loop
+  copies it with getTime(), which retries when an ISR wrote it in between
+  instead of disabling interrupts, and posts new times with setTime(), which
+  the Timer1 ISR applies.
+*/
+static time_t time;
+static volatile uint8_t timeSequence = 0;
+static time_t requestedTime;
+static volatile bool timeRequested = false;
+static volatile bool syncing = false;
+
+static uint8_t rawGsData[ROWS][COLUMNS];
+static uint16_t frame[ROWS];
+static uint16_t previousFrame[ROWS];
+static uint8_t rowBrightness[ROWS];
+static uint8_t fade = 0;
+
+/* test/snapshot.c defines barrier() to inject interrupts between the copies */
+#ifndef barrier
+#define barrier() __asm__ __volatile__ ("" ::: "memory")
+#endif
+
+static void getTime(time_t* snapshot) {
+  uint8_t sequence;
+  do {
+    sequence = timeSequence;
+    barrier();
+    *snapshot = time;
+    barrier();
+  } while (sequence != timeSequence);
+}
+
+static void setTime(const time_t* newTime) {
+  timeRequested = false;
+  barrier();
+  requestedTime = *newTime;
+  barrier();
+  timeRequested = true;
+}
+
+/*
+  ticks counts the Timer1 ticks of the current second, which started when
+  TCNT1 was at tickStart.
+*/
+static void restartTicks(uint16_t count) {
+  ticks = 0;
+  tickStart = count;
+}
+
+/*
+  A read that completes while a new time is pending started before it was
+  written to the RTC, so it is ignored.
+*/
 static void rtcCallback(time_t* rtc_time) {
-  time = *rtc_time;
+  if (isRtcRunning() && !timeRequested) {
+    if (!squareWave && rtc_time->seconds != time.seconds) {
+      restartTicks(TCNT1);
+    }
+    time = *rtc_time;
+    timeSequence += 1;
+  }
+}
+
+/*
+  Called on every falling edge of the DS1307 SQW output. While the square wave
+  is present it is the seconds time base, and the RTC is only read once per
+  minute to pick up the date. Without it, the RTC is polled every tick.
+*/
+static void secondCallback() {
+  uint16_t count = TCNT1;
+  uint8_t elapsedTicks = ticks;
+  uint16_t start = count;
+  if (bit_is_set(TIFR1, OCF1A) && count < OCR1A / 2) {
+    elapsedTicks += 1;
+    /* the pending tick belongs to the previous second */
+    start += US_PER_TICK;
+  }
+  calibrateOscillator(elapsedTicks, count);
+  if (hostSeconds) {
+    hostSeconds -= 1;
+  }
+  restartTicks(start);
+  squareWave = true;
+  timeSequence += 1;
+  time.seconds += 1;
+  if (time.seconds < SECONDS_PER_MINUTE) {
+    return;
+  }
+  time.seconds = 0;
+  time.minutes += 1;
+  if (time.minutes == MINUTES_PER_HOUR) {
+    time.minutes = 0;
+    time.hours += 1;
+    if (time.hours == HOURS_PER_DAY) {
+      time.hours = 0;
+    }
+  }
+  readPending = !readTime(&rtcCallback);
+}
+
+static int32_t getSecondsOfDay(time_t* time) {
+  return ((int32_t) time->hours * MINUTES_PER_HOUR + time->minutes) * SECONDS_PER_MINUTE + time->seconds;
+}
+
+static int16_t getOffset(time_t* from, time_t* to) {
+  int32_t offset = getSecondsOfDay(to) - getSecondsOfDay(from);
+  if (offset > INT16_MAX) {
+    return INT16_MAX;
+  } else if (offset < INT16_MIN) {
+    return INT16_MIN;
+  }
+  return offset;
 }
 
 ISR(TIMER1_COMPA_vect) {
+  countProfilePeriod();
+  profile_t profile = startProfile();
   time_t dcf77Time;
+  if (ticks < UINT8_MAX) {
+    ticks += 1;
+  }
+  clockTicks += 1;
+  if (watchdogTicks < UINT8_MAX) {
+    watchdogTicks += 1;
+  }
+  superviseTwi();
+  if (ticks > SQUARE_WAVE_TIMEOUT) {
+    squareWave = false;
+  }
   if (trackDcf77(&dcf77Time)) {
+    logEvent(LOG_DCF77_SYNC, getOffset(&time, &dcf77Time));
     time = dcf77Time;
+    timeSequence += 1;
     writeTime(&time);
-    maximum_brightness = MAXIMUM_BRIGHTNESS;
     disableDcf77();
-  } else {
-    readTime(&rtcCallback);
+  } else if (syncing) {
+    /* applySync writes the RTC itself */
+  } else if (timeRequested) {
+    if (writeTime(&requestedTime)) {
+      time = requestedTime;
+      timeSequence += 1;
+      restartTicks(TCNT1);
+      timeRequested = false;
+    }
+  } else if (!isRtcRunning()) {
+    time = defaultTime;
+    timeSequence += 1;
+    writeTime(&time);
+  } else if (!squareWave || readPending) {
+    readPending = !readTime(&rtcCallback);
+  }
+  endProfile(PROFILE_TIMER1, profile);
+}
+
+static bool canPowerSave() {
+  return squareWave && !hostSeconds && !isDcf77Enabled() && settings.sync != SYNC_FOLLOWER && isRtcIdle() && uart_tx_idle();
+}
+
+/*
+  The USART does not run in power-save mode, so a start bit on RXD wakes the
+  MCU instead. The first byte is lost, and the MCU then stays in idle sleep
+  until the host has been quiet for HOST_TIMEOUT seconds. Hosts wake the
+  clock with an empty line.
+*/
+static void enterSleep() {
+  if (!canPowerSave()) {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_mode();
+    return;
+  }
+  set_sleep_mode(SLEEP_MODE_PWR_SAVE);
+  uart_wake(true);
+  sleep_mode();
+  uart_wake(false);
+  if (uart_rx_started()) {
+    hostSeconds = HOST_TIMEOUT;
   }
 }
 
@@ -318,9 +303,11 @@ static void init(void) {
 }
 
 static void getDisplayTime(time_t* displayTime) {
-  uint8_t diff = time.seconds >= 30 ? 3 : 2;
-  displayTime->minutes = time.minutes + diff;
-  displayTime->hours = time.hours % 12;
+  time_t now;
+  getTime(&now);
+  uint8_t diff = settings.dots != DOTS_OFF ? 0 : now.seconds >= 30 ? 3 : 2;
+  displayTime->minutes = now.minutes + diff;
+  displayTime->hours = now.hours % 12;
   if (displayTime->minutes >= MINUTES_PER_HOUR) {
     displayTime->minutes -= MINUTES_PER_HOUR;
     displayTime->hours += 1;
@@ -330,108 +317,642 @@ static void getDisplayTime(time_t* displayTime) {
   }
 }
 
-static void handleMatrix() {
-  static uint8_t rawGsData[ROWS][COLUMNS];
+typedef char check_phrase_rows[ROWS >= PHRASE_ROWS ? 1 : -1];
+
+/*
+  The words only change with the five minute slot, the hour or the layout, so
+  the phrase is planned again only when one of them changes. Returns false if
+  data still holds the current words.
+*/
+static bool planFrame(uint16_t data[]) {
+  static uint16_t planned = UINT16_MAX;
   time_t displayTime;
 
   getDisplayTime(&displayTime);
+  uint16_t key = (uint16_t) settings.layout << 8 | (displayTime.hours * 12 + displayTime.minutes / 5);
+  if (key == planned) {
+    return false;
+  }
+  planned = key;
+  for (uint8_t i = PHRASE_ROWS; i < ROWS; i += 1) {
+    data[i] = 0;
+  }
+  planPhrase(displayTime.hours, displayTime.minutes, settings.layout, data);
+  return true;
+}
+
+static uint8_t countBits(uint16_t data) {
+  uint8_t count = 0;
+  while (data) {
+    count += data & 1;
+    data >>= 1;
+  }
+  return count;
+}
+
+/*
+  The average anode current of a row is proportional to the sum of its
+  grayscale values. Rows with more lit outputs than the budget allows at full
+  brightness are limited to the highest brightness whose gamma value keeps
+  the row within the budget. This only runs when the frame or the settings
+  change.
+*/
+static void limitRows() {
+  uint16_t maximum = getGammaValue(MAXIMUM_BRIGHTNESS);
+
   for (uint8_t i = 0; i < ROWS; i += 1) {
-    for (uint8_t j = 0; j < COLUMNS; j += 1) {
-      uint8_t current = rawGsData[i][j];
-      uint16_t data;
-      if (i < 4) {
-	data = minuteData[displayTime.minutes / 5][i];
-      } else {
-	if (displayTime.minutes < 5) {
-	  data = fullHourData[displayTime.hours][i - 4];
-	} else if (displayTime.minutes < 25) {
-	  data = hourData[displayTime.hours][i - 4];
+    uint8_t count = countBits(frame[i]);
+    if (i == DOTS_ROW && settings.dots != DOTS_OFF) {
+      count += MINUTE_DOTS + 1;
+    }
+    uint8_t limit = MAXIMUM_BRIGHTNESS;
+    if (settings.budget && count > settings.budget) {
+      uint16_t value = (uint32_t) maximum * settings.budget / count;
+      uint8_t low = MINIMUM_BRIGHTNESS;
+      uint8_t high = MAXIMUM_BRIGHTNESS;
+      while (low < high) {
+	uint8_t middle = low + (high - low + 1) / 2;
+	if (getGammaValue(middle) <= value) {
+	  low = middle;
 	} else {
-	  data = hourData[(displayTime.hours + 1) % 12][i - 4];
+	  high = middle - 1;
 	}
       }
-      uint8_t target = data & _BV(COLUMNS - 1 - j) ? maximum_brightness : MINIMUM_BRIGHTNESS;
-      if (current > target) {
-	current -= 1;
-      } else if (current < target) {
-	current += 1;
-      } else {
+      limit = low;
+    }
+    rowBrightness[i] = maximum_brightness < limit ? maximum_brightness : limit;
+  }
+}
+
+/*
+  Sets every cell to its final value, so that the first frame after reset
+  already shows the correct words. The fade-in from black is then done by
+  scaling all cells with fade, which rises by FADE_IN_STEP per transition.
+*/
+static void prefillMatrix() {
+  planFrame(frame);
+  limitRows();
+  for (uint8_t i = 0; i < ROWS; i += 1) {
+    for (uint8_t j = 0; j < COLUMNS; j += 1) {
+      rawGsData[i][j] = frame[i] & _BV(COLUMNS - 1 - j) ? rowBrightness[i] : MINIMUM_BRIGHTNESS;
+    }
+  }
+}
+
+static bool updateFrame() {
+  uint16_t data[ROWS];
+  bool changed = false;
+
+  if (!planFrame(data)) {
+    return false;
+  }
+  for (uint8_t i = 0; i < ROWS; i += 1) {
+    changed |= data[i] != frame[i];
+  }
+  if (changed) {
+    for (uint8_t i = 0; i < ROWS; i += 1) {
+      previousFrame[i] = frame[i];
+      frame[i] = data[i];
+    }
+    const rule_t* rule = getActiveRule();
+    startEffect(rule && rule->effect != EFFECT_KEEP ? rule->effect : settings.effect);
+  }
+  return changed;
+}
+
+/*
+  The minute dots and the seconds pulse are wired to the spare outputs of
+  the first row, which are shifted out with every row anyway.
+*/
+static void handleDots(bool force) {
+  static uint8_t dots = 0;
+  uint8_t current = 0;
+
+  if (settings.dots != DOTS_OFF) {
+    time_t now;
+    getTime(&now);
+    current = _BV(now.minutes % 5) - 1;
+    if (settings.dots == DOTS_SECONDS && ticks < SECONDS_PULSE) {
+      current |= _BV(MINUTE_DOTS);
+    }
+  }
+  if (current == dots && !force) {
+    return;
+  }
+  dots = current;
+  uint16_t value = getGammaValue(((uint16_t) rowBrightness[DOTS_ROW] * (fade + 1)) >> 8);
+  for (uint8_t i = 0; i <= MINUTE_DOTS; i += 1) {
+    setMatrixData(DOTS_ROW, MINUTE_DOT_CHANNEL + i, dots & _BV(i) ? value : 0);
+  }
+}
+
+static void applySchedule() {
+  const rule_t* rule = getActiveRule();
+  if (rule && rule->flags & _BV(RULE_BLANK)) {
+    blankMatrix();
+    return;
+  }
+  maximum_brightness = rule && !(rule->flags & _BV(RULE_KEEP_BRIGHTNESS)) ? rule->brightness : settings.brightness;
+  if (isMatrixOverheated() && settings.thermal && maximum_brightness > settings.thermal) {
+    maximum_brightness = settings.thermal;
+  }
+  redraw = true;
+  resumeMatrix();
+}
+
+/*
+  The bootloader has no room to search the settings records, so it reads a
+  copy of the calibration from OSCCAL_ADDRESS.
+*/
+static void storeCalibration(uint8_t calibration) {
+  setSetting(offsetof(settings_t, osccal), calibration);
+  eeprom_update_byte((uint8_t*) OSCCAL_ADDRESS, calibration);
+}
+
+static void handleCalibration() {
+  uint8_t calibration = getCalibration();
+  if (calibration && calibration != settings.osccal) {
+    storeCalibration(calibration);
+  }
+}
+
+/*
+  While a TLC5940 reports a thermal error, the brightness is limited to the
+  thermal setting, if set.
+*/
+static void handleFaults() {
+  if (checkMatrixStatus()) {
+    logEvent(LOG_THERMAL, isMatrixOverheated());
+    applySchedule();
+  }
+}
+
+static void handleSchedule() {
+  time_t now;
+  getTime(&now);
+  if (updateSchedule(&now)) {
+    applySchedule();
+  }
+}
+
+static void handleMatrix() {
+  bool force = redraw;
+
+  redraw = false;
+  const rule_t* rule = getActiveRule();
+  if (rule && rule->flags & _BV(RULE_FLASH) && ticks >= SECONDS_PULSE) {
+    fade = 0;
+  }
+  if (fade < MAXIMUM_FADE) {
+    fade = fade > MAXIMUM_FADE - FADE_IN_STEP ? MAXIMUM_FADE : fade + FADE_IN_STEP;
+    force = true;
+  }
+  advanceEffect();
+  if (updateFrame() || force) {
+    limitRows();
+  }
+  bool transition = isEffectRunning();
+  for (uint8_t i = 0; i < ROWS; i += 1) {
+    uint16_t changes = transition ? frame[i] ^ previousFrame[i] : 0;
+    uint8_t brightness = rowBrightness[i];
+    for (uint8_t j = 0; j < COLUMNS; j += 1) {
+      uint16_t mask = _BV(COLUMNS - 1 - j);
+      uint8_t current = rawGsData[i][j];
+      uint8_t target = frame[i] & mask ? brightness : MINIMUM_BRIGHTNESS;
+      bool changing = changes & mask;
+      if (!changing && current == target && !force) {
 	continue;
       }
+      current = blendCell(current, target, brightness, changing, changing ? getEffectPhase(i, j) : 0);
       rawGsData[i][j] = current;
-      setMatrixData(i, j, getGammaValue(current));
+      setMatrixData(i, j, getGammaValue(((uint16_t) current * (fade + 1)) >> 8));
+    }
+  }
+  handleDots(force);
+}
+
+/* Returns the µs since the current second started. */
+static uint32_t getElapsed() {
+  uint8_t elapsedTicks;
+  uint16_t count;
+  uint16_t start;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    elapsedTicks = ticks;
+    start = tickStart;
+    count = TCNT1;
+    if (bit_is_set(TIFR1, OCF1A)) {
+      elapsedTicks += 1;
+      count = TCNT1;
+    }
+  }
+  return elapsedTicks * US_PER_TICK + count - start;
+}
+
+/* Returns a time in µs that wraps around, to measure intervals. */
+static uint32_t getClock() {
+  uint32_t elapsedTicks;
+  uint16_t count;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    elapsedTicks = clockTicks;
+    count = TCNT1;
+    if (bit_is_set(TIFR1, OCF1A)) {
+      elapsedTicks += 1;
+      count = TCNT1;
+    }
+  }
+  return elapsedTicks * US_PER_TICK + count;
+}
+
+static void handleSync() {
+  static uint8_t lastMinute = UINT8_MAX;
+
+  if (settings.sync == SYNC_OFF || (settings.sync == SYNC_FOLLOWER && !synced) || !isRtcRunning()) {
+    return;
+  }
+  time_t now;
+  getTime(&now);
+  if (now.seconds != SYNC_SECOND || now.minutes == lastMinute || !uart_tx_idle()) {
+    return;
+  }
+  if (isSyncDue(getElapsed())) {
+    sendSync(&now, &getElapsed);
+    lastMinute = now.minutes;
+  }
+}
+
+/*
+  Writing the seconds register aligns the second of the DS1307, so the time
+  is written right when the delay has passed instead of at the next tick.
+  The delay counts from the end of the frame, which the RX ISR stamped, so
+  the time the main loop took to get to the frame does not delay the second.
+  The write starts RTC_WRITE_US early, as the DS1307 only takes the seconds at
+  the end of the transfer. Meanwhile the Timer1 ISR starts no RTC transfer,
+  so the TWI is idle by then unless a transfer that started before the frame
+  arrived is still running.
+*/
+static void applySync(const char argument[], const uint8_t argument_length) {
+  uint32_t received = uart_line_time();
+  time_t syncTime;
+  uint8_t delay;
+
+  if (settings.sync != SYNC_FOLLOWER || !receiveSync(argument, argument_length, &syncTime, &delay)) {
+    return;
+  }
+  syncing = true;
+  uint32_t wait = (uint32_t) delay * SYNC_UNIT_US;
+  wait = wait > RTC_WRITE_US ? wait - RTC_WRITE_US : 0;
+  while (getClock() - received < wait);
+  bool written = false;
+  while (!written) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      written = writeTime(&syncTime);
+      if (written) {
+	time = syncTime;
+	timeSequence += 1;
+	restartTicks(TCNT1);
+      }
+    }
+  }
+  syncing = false;
+  synced = true;
+}
+
+/*
+  The watchdog stays enabled after a watchdog reset. Without the bootloader
+  nothing else turns it off, so this runs before the C runtime. The
+  bootloader clears MCUSR itself and passes the reset cause in GPIOR0.
+*/
+void disableWatchdog(void) __attribute__ ((naked, used, section (".init3")));
+
+void disableWatchdog(void) {
+  resetCause = MCUSR ? MCUSR : GPIOR0;
+  MCUSR = 0;
+  wdt_disable();
+}
+
+/*
+  The watchdog is only reset while the matrix refresh advances, the TWI
+  completes its transfers and the UART drains its buffer. The checks run
+  every WATCHDOG_CHECK_TICKS, the watchdog is reset on every pass of the main
+  loop, including the wake-ups from power-save.
+
+  watchdogFaults keeps the failed checks across watchdog resets, and a check
+  that has already caused one is ignored until the next power-on. A fault
+  that a reset does not cure, like a dead DS1307 holding SDA low, then costs
+  one reset instead of one every few seconds. The bootloader only clears its
+  own .bss at the start of the RAM, far below .noinit.
+*/
+static void handleWatchdog() {
+  static bool alive = true;
+
+  if (watchdogTicks >= WATCHDOG_CHECK_TICKS) {
+    watchdogTicks = 0;
+    uint8_t faults = 0;
+    if (!isMatrixAlive()) {
+      faults |= _BV(FAULT_MATRIX);
+    }
+    if (!isTwiAlive()) {
+      faults |= _BV(FAULT_TWI);
+    }
+    if (!uart_tx_alive()) {
+      faults |= _BV(FAULT_UART);
+    }
+    faults &= ~watchdogFaults;
+    if (faults) {
+      watchdogFaults |= faults;
+      alive = false;
     }
   }
+  if (alive) {
+    wdt_reset();
+  }
+}
+
+/*
+  Applies a setting written with the s command at once. The brightness and
+  the thermal limit take effect through the schedule. The baud rate changes
+  at the next reset, so that the answer still reaches the host.
+*/
+static void applySetting(uint8_t key) {
+  if (key == offsetof(settings_t, refresh)) {
+    setRefreshMode(settings.refresh);
+    setGammaRange(getGrayscaleBits(), getGrayscaleMaximum());
+  } else if (key == offsetof(settings_t, gamma)) {
+    setGammaCurve(settings.gamma);
+  }
+  applySchedule();
+}
+
+/*
+  Resets through the watchdog. The request makes the bootloader wait for the
+  uploader instead of starting the application.
+*/
+static void startBootloader() {
+  uart_putc(COMMAND_UPDATE);
+  uart_puts(CRLF);
+  while (!uart_tx_idle());
+  blankMatrix();
+  cli();
+  eeprom_update_byte((uint8_t*) BOOT_REQUEST, BOOT_REQUEST_UPDATE);
+  eeprom_busy_wait();
+  wdt_enable(WDTO_15MS);
+  for (;;);
+}
+
+/*
+  Returns the day of the week of a date in 2000 to 2099 as DCF77 numbers it,
+  1 being Monday and 7 Sunday, or 0 for an invalid month, which schedule
+  rules treat as any day. Uses Sakamoto's method.
+*/
+static uint8_t getDayOfWeek(const time_t* time) {
+  static const uint8_t offsets[12] = { 0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4 };
+  if (time->month < 1 || time->month > 12) {
+    return 0;
+  }
+  uint16_t year = 2000 + time->year - (time->month < 3 ? 1 : 0);
+  uint8_t day = (year + year / 4 - year / 100 + year / 400 + offsets[time->month - 1] + time->day) % 7;
+  return day ? day : 7;
+}
+
+/*
+  Parses a time given as YYMMDDhhmmss and derives the day of the week from
+  the date. The time is left unchanged unless all fields are valid.
+*/
+static bool parseTime(const char argument[], time_t* time) {
+  time_t parsed = *time;
+  if (uart_parsedec(argument, 2, &parsed.year) && uart_parsedec(argument + 2, 2, &parsed.month) && uart_parsedec(argument + 4, 2, &parsed.day)
+      && uart_parsedec(argument + 6, 2, &parsed.hours) && uart_parsedec(argument + 8, 2, &parsed.minutes) && uart_parsedec(argument + 10, 2, &parsed.seconds)) {
+    parsed.dayOfWeek = getDayOfWeek(&parsed);
+    *time = parsed;
+    return true;
+  }
+  return false;
 }
 
+/*
+  A command whose argument does not parse changes nothing. Where the argument
+  selects the value to report, an invalid one reports nothing.
+*/
 static void execute_command(const uint8_t command, const char argument[], const uint8_t argument_length) {
+  if (command == COMMAND_SYNC) {
+    applySync(argument, argument_length);
+    return;
+  } else if (command == COMMAND_UPDATE) {
+    startBootloader();
+  }
   uart_putc(command);
   if (command == COMMAND_VERSION) {
     uart_puts(VERSION);
   } else if (command == COMMAND_BRIGHTNESS) {
-    if (argument_length == 2) {
-      sscanf(argument, "%2hhX", &maximum_brightness);
+    uint8_t brightness;
+    if (argument_length == 2 && uart_parsehex(argument, &brightness)) {
+      logEvent(LOG_BRIGHTNESS, brightness);
+      setSetting(offsetof(settings_t, brightness), brightness);
+      applySchedule();
+      redraw = true;
     }
     char formatted_output[3];
     sprintf(formatted_output, "%02X", maximum_brightness);
     uart_puts(formatted_output);
   } else if (command == COMMAND_TIME) {
-    if (argument_length == 12) {
-      sscanf(argument, "%2hhd%2hhd%2hhd%2hhd%2hhd%2hhd", &time.year, &time.month, &time.day, &time.hours, &time.minutes, &time.seconds);
-      writeTime(&time);
+    time_t now;
+    getTime(&now);
+    if (argument_length == 12 && parseTime(argument, &now)) {
+      setTime(&now);
     }
     char formatted_time[13];
-    sprintf(formatted_time, "%02d%02d%02d%02d%02d%02d", time.year, time.month, time.day, time.hours, time.minutes, time.seconds);
+    sprintf(formatted_time, "%02d%02d%02d%02d%02d%02d", now.year, now.month, now.day, now.hours, now.minutes, now.seconds);
     uart_puts(formatted_time);
+  } else if (command == COMMAND_LOG) {
+    dumpLog();
+  } else if (command == COMMAND_SETTING) {
+    uint8_t key = argument_length ? SETTINGS_COUNT : 0;
+    uint8_t value;
+    if (argument_length == 2 || argument_length == 4) {
+      uart_parsehex(argument, &key);
+    }
+    if (argument_length == 4 && key < SETTINGS_COUNT && uart_parsehex(argument + 2, &value)) {
+      setSetting(key, value);
+      applySetting(key);
+    }
+    if (key < SETTINGS_COUNT) {
+      char formatted_setting[5];
+      sprintf(formatted_setting, "%02X%02X", key, getSetting(key));
+      uart_puts(formatted_setting);
+    }
+  } else if (command == COMMAND_REFRESH) {
+    uint8_t mode;
+    if (argument_length == 2 && uart_parsehex(argument, &mode) && mode < REFRESH_MODES) {
+      setSetting(offsetof(settings_t, refresh), mode);
+      applySetting(offsetof(settings_t, refresh));
+    }
+    uint16_t cycles = getProfileCycles(PROFILE_MATRIX);
+    uint8_t load = (uint32_t) cycles * 100 / ((uint32_t) getRowPeriod() * (F_CPU / 1000000UL));
+    char formatted_refresh[13];
+    sprintf(formatted_refresh, "%02X%04X%04X%02X", getRefreshMode(), getRowPeriod(), cycles, load);
+    uart_puts(formatted_refresh);
+  } else if (command == COMMAND_EFFECT) {
+    uint8_t effect;
+    if (argument_length == 2 && uart_parsehex(argument, &effect) && effect < EFFECTS) {
+      setSetting(offsetof(settings_t, effect), effect);
+    }
+    char formatted_effect[3];
+    sprintf(formatted_effect, "%02X", settings.effect);
+    uart_puts(formatted_effect);
+  } else if (command == COMMAND_RULE) {
+    uint8_t index = RULES;
+    rule_t rule;
+    if (argument_length == 2 || argument_length == 2 + 2 * RULE_SIZE) {
+      uart_parsehex(argument, &index);
+    }
+    if (index < RULES) {
+      if (argument_length > 2) {
+	uint8_t i = 0;
+	while (i < RULE_SIZE && uart_parsehex(argument + 2 + 2 * i, (uint8_t*) &rule + i)) {
+	  i += 1;
+	}
+	if (i == RULE_SIZE) {
+	  writeRule(index, &rule);
+	  handleSchedule();
+	}
+      }
+      readRule(index, &rule);
+      uart_puthex(index);
+      for (uint8_t i = 0; i < RULE_SIZE; i += 1) {
+	uart_puthex(((uint8_t*) &rule)[i]);
+      }
+    }
+  } else if (command == COMMAND_PROFILE) {
+    char formatted_profile[5];
+    for (uint8_t i = 0; i < PROFILES; i += 1) {
+      sprintf(formatted_profile, "%04X", getProfileCycles(i));
+      uart_puts(formatted_profile);
+    }
+    uint32_t bytes = getShiftedBytes();
+    for (uint8_t i = 0; i < sizeof(bytes); i += 1) {
+      uart_puthex(bytes >> 24);
+      bytes <<= 8;
+    }
+    uint16_t dropped = uart_dropped();
+    uart_puthex(dropped >> 8);
+    uart_puthex(dropped);
+    resetProfiles();
+  } else if (command == COMMAND_FAULTS) {
+    if (argument_length == 2) {
+      clearOpenChannels();
+    }
+    char formatted_faults[5];
+    for (uint8_t i = 0; i < ROWS; i += 1) {
+      for (uint8_t k = 0; k < TLC5940_COUNT; k += 1) {
+	sprintf(formatted_faults, "%04X", getOpenChannels(i, k));
+	uart_puts(formatted_faults);
+      }
+    }
+    uart_puthex(isMatrixOverheated());
+  } else if (command == COMMAND_MEMORY) {
+    char formatted_free[5];
+    sprintf(formatted_free, "%04X", getStackFree());
+    uart_puts(formatted_free);
   }
   uart_puts(CRLF);
 }
 
+/*
+  byte_count counts the command, the argument and the CR of the current line.
+  Lines with a longer argument than the buffer holds, or of which the receive
+  buffer dropped bytes, are discarded instead of being executed truncated.
+*/
 static void handleUart() {
   static uint8_t command;
   static char argument[ARGUMENT_BUFFER_SIZE + 1];
-  static uint8_t byte_count;
+  static uint8_t byte_count = 0;
   static uint8_t last_byte = 0;
+  static bool lost = false;
 
-  if (uart_has_data()) {
+  while (uart_has_data()) {
     uint8_t byte = uart_getc();
-    if (byte_count < ARGUMENT_BUFFER_SIZE + 3) {
-      byte_count += 1;
-    }
+    hostSeconds = HOST_TIMEOUT;
+    lost |= uart_lost();
     if (last_byte == CR && byte == LF) {
-      if (byte_count > 2) {
-	argument[byte_count - 3] = 0x00;
-	execute_command(command, argument, byte_count - 3);
+      if (byte_count >= 2 && byte_count <= ARGUMENT_BUFFER_SIZE + 2 && !lost) {
+	argument[byte_count - 2] = 0x00;
+	execute_command(command, argument, byte_count - 2);
       }
       byte_count = 0;
-    } else if (byte_count == 1) {
-      command = byte;
-    } else if (byte_count - 2 < ARGUMENT_BUFFER_SIZE) {
-      argument[byte_count - 2] = byte;
+      lost = false;
+    } else {
+      if (byte_count == 0) {
+	command = byte;
+      } else if (byte_count <= ARGUMENT_BUFFER_SIZE) {
+	argument[byte_count - 1] = byte;
+      }
+      if (byte_count < UINT8_MAX) {
+	byte_count += 1;
+      }
     }
     last_byte = byte;
   }
 }
 
 int main(void) {
+  loadSettings();
+  if (settings.osccal) {
+    OSCCAL = settings.osccal;
+    storeCalibration(settings.osccal);
+  }
+  maximum_brightness = settings.brightness;
+  setGammaCurve(settings.gamma);
+
   init();
   initMatrix();
+  setRefreshMode(settings.refresh);
+  setGammaRange(getGrayscaleBits(), getGrayscaleMaximum());
   initRtc();
-  uart_init();
+  initSquareWave(&secondCallback);
+  initLog();
+  uart_init(settings.baud);
+  uart_stamp_lines(&getClock);
+  initSync(settings.baud);
 
-  sei();
+  if (!(resetCause & _BV(WDRF))) {
+    watchdogFaults = 0;
+  }
+  logEvent(LOG_BOOT, (uint16_t) watchdogFaults << 8 | resetCause);
 
-  time.year = 13;
-  time.month = 1;
-  time.day = 1;
-  time.hours = 10;
-  time.minutes = 0;
-  time.seconds = 0;
-  writeTime(&time);
+  readTimeNow(&rtcCallback);
+  if (!isRtcRunning()) {
+    time = defaultTime;
+  }
+  if (!(resetCause & _BV(PORF)) && resetCause & (_BV(WDRF) | _BV(BORF))) {
+    fade = MAXIMUM_FADE;
+  }
+  handleSchedule();
+  prefillMatrix();
+  handleMatrix();
+  startMatrix();
+
+  wdt_enable(WDTO_2S);
+  sei();
 
   for (;;) {
-    _delay_ms(TRANSITION_DELAY);
+    for (uint8_t i = 0; i < TRANSITION_DELAY; i += 1) {
+      if (isMatrixBlanked()) {
+	enterSleep();
+      } else {
+	_delay_ms(1);
+      }
+      handleUart();
+      handleSync();
+      handleWatchdog();
+    }
+    profile_t profile = startProfile();
+    handleSchedule();
+    handleCalibration();
+    handleFaults();
     handleMatrix();
-    handleUart();
+    time_t now;
+    getTime(&now);
+    flushLog(&now);
+    endProfile(PROFILE_LOOP, profile);
   }
 }
@@ -13,10 +13,15 @@
    See the License for the specific language governing permissions and
    limitations under the License.
 */
+#include <stdbool.h>
 #include <stdint.h>
 #include <avr/interrupt.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include <util/delay.h>
 #include "matrix.h"
+#include "profile.h"
 
 #define GSCLK_DDR       DDRB
 #define GSCLK_PORT      PORTB
@@ -60,9 +65,91 @@
 #define toggle(port, pin)  ((port) ^= _BV(pin))
 #define pulse(port, pin)    { setHigh((port), (pin)); setLow((port), (pin)); }
 
-#define GS_DATA_SIZE 24
+#define GS_DATA_SIZE (24 * TLC5940_COUNT)
+
+#define MAXIMUM_PHASE 0xFF
+
+/*
+  The SPI runs at F_CPU / 2, so a byte takes 16 clocks plus the polling loop.
+  Shifting a row may take at most half of the row period, so that the main
+  loop keeps running. Refresh modes with shorter rows are not available with
+  long chains, and the normal mode must always fit.
+*/
+#define SPI_BYTE_CLOCKS  20
+#define ROW_SHIFT_CLOCKS ((uint32_t) GS_DATA_SIZE * SPI_BYTE_CLOCKS)
+
+#define ANODE_SETTLE_US 2
+
+/*
+  BLANK is high for about BLANK_CLOCKS of every row period, including the
+  variation in the response time of the interrupt, and for the settle time
+  of the staggered mode on top. The grayscale values are clipped to what is
+  left of the PWM cycle, so that even the brightest output has turned off
+  before BLANK ends the row. test/timing.py checks the estimate.
+*/
+#define BLANK_CLOCKS 32
+
+/*
+  The last three bytes shifted out of each TLC5940 after a latch are the end
+  of its status information: TEF in bit 0 of the first, then LOD15..8 and
+  LOD7..0.
+*/
+#define STATUS_SIZE     3
+#define CHIP_DATA_SIZE  (GS_DATA_SIZE / TLC5940_COUNT)
+#define STATUS_TEF      0
+
+#define NO_ROW          0xFF
+
+#define PRESCALER_256  _BV(CS02)
+#define PRESCALER_1024 (_BV(CS02) | _BV(CS00))
+
+#define ROW_CLOCKS(prescaler, compare) (((compare) + 1UL) * (prescaler))
+
+typedef struct {
+  uint8_t prescaler;
+  uint8_t compare;
+  uint8_t bits;
+  uint8_t settle;
+} refresh_t;
+
+/*
+  GSCLK is the system clock on CLKO, so a row period of 4096 clocks is exactly
+  one 12 bit PWM cycle of the TLC5940. The fast modes shorten the row period
+  to 2048 or 1024 clocks and limit the grayscale values to 11 or 10 bits, so
+  that every output has turned off before BLANK ends the row, at two or four
+  times the frame rate. The staggered mode switches the anodes while BLANK is
+  high and waits for them to settle before the outputs turn on, so that the
+  anode and cathode current steps do not coincide.
+*/
+static const refresh_t refreshModes[REFRESH_MODES] PROGMEM = {
+  { PRESCALER_1024, 0x03, 12, 0 },
+  { PRESCALER_256, 0x07, 11, 0 },
+  { PRESCALER_1024, 0x03, 12, 1 },
+  { PRESCALER_256, 0x03, 10, 0 },
+};
+
+typedef char check_normal[ROW_CLOCKS(1024, 0x03) == 1UL << 12 ? 1 : -1];
+typedef char check_fast[ROW_CLOCKS(256, 0x07) == 1UL << 11 ? 1 : -1];
+typedef char check_fastest[ROW_CLOCKS(256, 0x03) == 1UL << 10 ? 1 : -1];
+typedef char check_chain[ROW_CLOCKS(1024, 0x03) >= 2 * ROW_SHIFT_CLOCKS ? 1 : -1];
+typedef char check_columns[COLUMNS <= CHANNELS && CHANNELS <= 256 ? 1 : -1];
 
 volatile uint8_t gsData[ROWS][GS_DATA_SIZE];
+static uint8_t row = 0;
+static uint8_t prescaler;
+static uint8_t compare;
+static uint8_t refreshMode = REFRESH_NORMAL;
+static uint8_t grayscaleBits = 12;
+static bool blanked = false;
+static volatile uint32_t shiftedRows = 0;
+static volatile uint8_t anodeSettle = 0;
+static uint8_t latchedRow = NO_ROW;
+static uint8_t status[TLC5940_COUNT][STATUS_SIZE];
+static volatile uint8_t statusRow = NO_ROW;
+static volatile uint8_t statusData[TLC5940_COUNT][STATUS_SIZE];
+static uint16_t activeChannels[ROWS][TLC5940_COUNT];
+static uint16_t openChannels[ROWS][TLC5940_COUNT];
+static bool overheated = false;
 
 void initMatrix(void) {
   setOutput(GSCLK_DDR, GSCLK_PIN);
@@ -80,14 +167,156 @@ void initMatrix(void) {
   SPSR = _BV(SPI2X);
 
   TCCR0A = _BV(WGM01);
-  TCCR0B = _BV(CS02) | _BV(CS00);
-  OCR0A = 0x03;
+  setRefreshMode(REFRESH_NORMAL);
+  TIMSK0 |= _BV(OCIE0A);
+}
+
+static uint32_t getRowClocks(uint8_t mode) {
+  uint16_t divider = pgm_read_byte(&refreshModes[mode].prescaler) == PRESCALER_1024 ? 1024 : 256;
+  return ROW_CLOCKS(divider, pgm_read_byte(&refreshModes[mode].compare));
+}
+
+void setRefreshMode(uint8_t mode) {
+  if (mode >= REFRESH_MODES || getRowClocks(mode) < 2 * ROW_SHIFT_CLOCKS) {
+    mode = REFRESH_NORMAL;
+  }
+  refreshMode = mode;
+  prescaler = pgm_read_byte(&refreshModes[mode].prescaler);
+  compare = pgm_read_byte(&refreshModes[mode].compare);
+  if (!blanked) {
+    OCR0A = compare;
+    TCNT0 = 0;
+    TCCR0B = prescaler;
+  }
+  grayscaleBits = pgm_read_byte(&refreshModes[mode].bits);
+  anodeSettle = pgm_read_byte(&refreshModes[mode].settle);
+  resetProfiles();
+}
+
+uint8_t getRefreshMode(void) {
+  return refreshMode;
+}
+
+uint16_t getRowPeriod(void) {
+  uint16_t divider = prescaler == PRESCALER_1024 ? 1024 : 256;
+  return ROW_CLOCKS(divider, compare) / (F_CPU / 1000000UL);
+}
+
+uint8_t getGrayscaleBits(void) {
+  return grayscaleBits;
+}
+
+uint16_t getGrayscaleMaximum(void) {
+  uint16_t settle = anodeSettle ? ANODE_SETTLE_US * (F_CPU / 1000000UL) : 0;
+  return (1 << grayscaleBits) - BLANK_CLOCKS - settle;
+}
+
+/*
+  The TLC5940s shift out their status while the next row is shifted in, so it
+  is captured here. The first block received comes from the last TLC5940.
+*/
+static inline void shiftRow(uint8_t index) {
+  const volatile uint8_t* data = gsData[index];
+  for (uint8_t k = TLC5940_COUNT; k-- > 0;) {
+    for (uint8_t i = 0; i < CHIP_DATA_SIZE - STATUS_SIZE; i++) {
+      SPDR = *data++;
+      loop_until_bit_is_set(SPSR, SPIF);
+    }
+    for (uint8_t i = 0; i < STATUS_SIZE; i++) {
+      SPDR = *data++;
+      loop_until_bit_is_set(SPSR, SPIF);
+      status[k][i] = SPDR;
+    }
+  }
+}
+
+/*
+  Turns all outputs off with BLANK and stops Timer0 and the SPI, so the
+  matrix draws no current and costs no CPU time until resumeMatrix.
+*/
+void blankMatrix(void) {
+  if (blanked) {
+    return;
+  }
+  blanked = true;
+  TIMSK0 &= ~_BV(OCIE0A);
+  TCCR0B = 0;
+  setHigh(BLANK_PORT, BLANK_PIN);
+  SPCR = 0;
+  PRR |= _BV(PRTIM0) | _BV(PRSPI);
+}
+
+/*
+  Shifts the first row before the refresh restarts, so the first latch already
+  shows the current frame.
+*/
+static void restartRefresh(void) {
+  row = 0;
+  latchedRow = NO_ROW;
+  shiftRow(row);
+  OCR0A = compare;
+  TCNT0 = 0;
+  TIFR0 = _BV(OCF0A);
+  TCCR0B = prescaler;
   TIMSK0 |= _BV(OCIE0A);
 }
 
+void resumeMatrix(void) {
+  if (!blanked) {
+    return;
+  }
+  PRR &= ~(_BV(PRTIM0) | _BV(PRSPI));
+  SPCR = _BV(SPE) | _BV(MSTR);
+  restartRefresh();
+  blanked = false;
+}
+
+void startMatrix(void) {
+  if (!blanked) {
+    restartRefresh();
+  }
+}
+
+bool isMatrixBlanked(void) {
+  return blanked;
+}
+
+uint32_t getShiftedBytes(void) {
+  uint32_t rows;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    rows = shiftedRows;
+  }
+  return rows * GS_DATA_SIZE;
+}
+
+/*
+  Returns false if no row has been shifted since the previous call while the
+  matrix is on.
+*/
+bool isMatrixAlive(void) {
+  static uint32_t lastRows = 0;
+  uint32_t rows;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    rows = shiftedRows;
+  }
+  bool alive = blanked || rows != lastRows;
+  lastRows = rows;
+  return alive;
+}
+
+/*
+  The first byte shifted out ends up in the last TLC5940 of the chain, so the
+  highest channel comes first.
+*/
 void setMatrixData(uint8_t row, uint8_t channel, uint16_t value) {
-  uint8_t channelPos = 15 - channel;
-  uint8_t i = (channelPos * 3) >> 1;
+  uint16_t mask = _BV(channel % 16);
+  if (value) {
+    activeChannels[row][channel / 16] |= mask;
+  } else {
+    activeChannels[row][channel / 16] &= ~mask;
+  }
+  uint8_t channelPos = CHANNELS - 1 - channel;
+  uint16_t i = ((uint16_t) channelPos * 3) >> 1;
   if (channelPos % 2 == 0) {
     gsData[row][i] = (uint8_t)((value >> 4));
     gsData[row][i + 1] = (uint8_t) ((gsData[row][i + 1] & 0x0F) | (uint8_t)(value << 4));
@@ -97,8 +326,24 @@ void setMatrixData(uint8_t row, uint8_t channel, uint16_t value) {
   }
 }
 
+/*
+  Returns the next value of a cell on its way from current to target, which
+  is either brightness or off. A cell that changes in a running transition
+  follows the phase of the effect, the others move by one level per step.
+*/
+uint8_t blendCell(uint8_t current, uint8_t target, uint8_t brightness, bool changing, uint8_t phase) {
+  if (changing) {
+    return ((uint16_t) brightness * (target ? phase : MAXIMUM_PHASE - phase)) >> 8;
+  } else if (current > target) {
+    return current - 1;
+  } else if (current < target) {
+    return current + 1;
+  }
+  return current;
+}
+
 ISR(TIMER0_COMPA_vect) {
-  static uint8_t row = 0;
+  profile_t profile = startProfile();
 
   setHigh(BLANK_PORT, BLANK_PIN);
   if (row == 0) {
@@ -107,14 +352,66 @@ ISR(TIMER0_COMPA_vect) {
     pulse(ANODES_CLK_PORT, ANODES_CLK_PIN);
   }
   pulse(XLAT_PORT, XLAT_PIN);
+  uint8_t displayedRow = latchedRow;
+  latchedRow = row;
+  if (anodeSettle) {
+    _delay_us(ANODE_SETTLE_US);
+  }
   setLow(BLANK_PORT, BLANK_PIN);
   row += 1;
   if (row == ROWS) {
     row = 0;
   }
 
-  for (uint8_t i = 0; i < GS_DATA_SIZE; i++) {
-    SPDR = gsData[row][i];
-    loop_until_bit_is_set(SPSR, SPIF);
+  shiftRow(row);
+  shiftedRows += 1;
+  if (statusRow == NO_ROW && displayedRow != NO_ROW) {
+    for (uint8_t k = 0; k < TLC5940_COUNT; k++) {
+      for (uint8_t i = 0; i < STATUS_SIZE; i++) {
+	statusData[k][i] = status[k][i];
+      }
+    }
+    statusRow = displayedRow;
+  }
+  endProfile(PROFILE_MATRIX, profile);
+}
+
+/*
+  Evaluates the status captured by the ISR for one row. An open LED is only
+  reported for channels that were on, because LOD is not valid for outputs
+  that are off. Returns true if the thermal error flag changed.
+*/
+bool checkMatrixStatus(void) {
+  uint8_t statusForRow = statusRow;
+  if (statusForRow == NO_ROW) {
+    return false;
+  }
+  bool tef = false;
+  for (uint8_t k = 0; k < TLC5940_COUNT; k++) {
+    uint16_t lod = (uint16_t) statusData[k][1] << 8 | statusData[k][2];
+    openChannels[statusForRow][k] |= lod & activeChannels[statusForRow][k];
+    tef |= bit_is_set(statusData[k][0], STATUS_TEF);
+  }
+  statusRow = NO_ROW;
+  if (tef == overheated) {
+    return false;
+  }
+  overheated = tef;
+  return true;
+}
+
+bool isMatrixOverheated(void) {
+  return overheated;
+}
+
+uint16_t getOpenChannels(uint8_t row, uint8_t chip) {
+  return openChannels[row][chip];
+}
+
+void clearOpenChannels(void) {
+  for (uint8_t i = 0; i < ROWS; i++) {
+    for (uint8_t k = 0; k < TLC5940_COUNT; k++) {
+      openChannels[i][k] = 0;
+    }
   }
 }
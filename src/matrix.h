@@ -16,13 +16,65 @@
 #ifndef __MATRIX_H_
 #define __MATRIX_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 
-#define ROWS     9
-#define COLUMNS 11
+/*
+  The number of daisy-chained TLC5940s and of anode rows can be set at build
+  time. Channel 0 is OUT0 of the first TLC5940 after the microcontroller, and
+  channel 16 * n + i is OUTi of the n-th one.
+*/
+#ifndef TLC5940_COUNT
+#define TLC5940_COUNT 1
+#endif
+#ifndef ROWS
+#define ROWS          9
+#endif
+
+#define COLUMNS      11
+#define CHANNELS     (16 * TLC5940_COUNT)
+
+#define REFRESH_NORMAL    0
+#define REFRESH_FAST      1
+#define REFRESH_STAGGERED 2
+#define REFRESH_FASTEST   3
+#define REFRESH_MODES     4
 
 void initMatrix(void);
 
+void setRefreshMode(uint8_t mode);
+
+uint8_t getRefreshMode(void);
+
+uint16_t getRowPeriod(void);
+
+uint8_t getGrayscaleBits(void);
+
+uint16_t getGrayscaleMaximum(void);
+
+void blankMatrix(void);
+
+void resumeMatrix(void);
+
+/* Restarts the refresh with interrupts disabled, so that the first latch shows the frame in gsData. */
+void startMatrix(void);
+
+bool isMatrixBlanked(void);
+
+uint32_t getShiftedBytes(void);
+
+bool isMatrixAlive(void);
+
 void setMatrixData(uint8_t row, uint8_t channel, uint16_t value);
 
+uint8_t blendCell(uint8_t current, uint8_t target, uint8_t brightness, bool changing, uint8_t phase);
+
+bool checkMatrixStatus(void);
+
+bool isMatrixOverheated(void);
+
+uint16_t getOpenChannels(uint8_t row, uint8_t chip);
+
+void clearOpenChannels(void);
+
 #endif
@@ -0,0 +1,172 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "phrases.h"
+
+#define WORD_ES         0
+#define WORD_IST        1
+#define WORD_FUENF      2
+#define WORD_ZEHN       3
+#define WORD_VIERTEL    4
+#define WORD_ZWANZIG    5
+#define WORD_VOR        6
+#define WORD_NACH       7
+#define WORD_HALB       8
+#define WORD_UHR        9
+#define WORD_EIN        10
+#define WORD_HOURS      11
+#define WORD_NONE       0xFF
+
+#define PHRASE_WORDS    3
+#define PHRASE_SLOTS    12
+
+#define NEXT_HOUR       0
+#define FULL_HOUR       1
+
+typedef struct {
+  uint8_t row;
+  uint16_t mask;
+} word_t;
+
+typedef struct {
+  uint8_t words[PHRASE_WORDS];
+  uint8_t flags;
+} phrase_t;
+
+/*
+  The words of the front plate. Hour words are indexed by WORD_HOURS plus the
+  hour, starting with ZWÖLF.
+*/
+static const word_t words[] PROGMEM = {
+  { 0, 0b11000000000 },
+  { 0, 0b00011100000 },
+  { 0, 0b00000001111 },
+  { 1, 0b00000001111 },
+  { 1, 0b11111110000 },
+  { 2, 0b11111110000 },
+  { 2, 0b00000000111 },
+  { 3, 0b11110000000 },
+  { 3, 0b00000001111 },
+  { 8, 0b00000000111 },
+  { 4, 0b00111000000 },
+  { 6, 0b00011111000 },
+  { 4, 0b00111100000 },
+  { 4, 0b11110000000 },
+  { 4, 0b00000011110 },
+  { 5, 0b11110000000 },
+  { 6, 0b00000001111 },
+  { 7, 0b01111100000 },
+  { 7, 0b00000111111 },
+  { 5, 0b00000001111 },
+  { 8, 0b00011110000 },
+  { 8, 0b11110000000 },
+  { 6, 0b11100000000 },
+};
+
+#define N WORD_NONE
+
+/*
+  The phrase for each five minute slot, after ES IST. The hour word follows,
+  for the next hour if NEXT_HOUR is set. FULL_HOUR adds UHR and uses EIN
+  instead of EINS. DREIVIERTEL is not on the front plate, so the regional
+  variants keep VIERTEL VOR.
+*/
+static const phrase_t phrases[LAYOUTS][PHRASE_SLOTS] PROGMEM = {
+  {
+    { { N, N, N }, _BV(FULL_HOUR) },
+    { { WORD_FUENF, WORD_NACH, N }, 0 },
+    { { WORD_ZEHN, WORD_NACH, N }, 0 },
+    { { WORD_VIERTEL, WORD_NACH, N }, 0 },
+    { { WORD_ZWANZIG, WORD_NACH, N }, 0 },
+    { { WORD_FUENF, WORD_VOR, WORD_HALB }, _BV(NEXT_HOUR) },
+    { { WORD_HALB, N, N }, _BV(NEXT_HOUR) },
+    { { WORD_FUENF, WORD_NACH, WORD_HALB }, _BV(NEXT_HOUR) },
+    { { WORD_ZWANZIG, WORD_VOR, N }, _BV(NEXT_HOUR) },
+    { { WORD_VIERTEL, WORD_VOR, N }, _BV(NEXT_HOUR) },
+    { { WORD_ZEHN, WORD_VOR, N }, _BV(NEXT_HOUR) },
+    { { WORD_FUENF, WORD_VOR, N }, _BV(NEXT_HOUR) },
+  },
+  {
+    { { N, N, N }, _BV(FULL_HOUR) },
+    { { WORD_FUENF, WORD_NACH, N }, 0 },
+    { { WORD_ZEHN, WORD_NACH, N }, 0 },
+    { { WORD_VIERTEL, WORD_NACH, N }, 0 },
+    { { WORD_ZEHN, WORD_VOR, WORD_HALB }, _BV(NEXT_HOUR) },
+    { { WORD_FUENF, WORD_VOR, WORD_HALB }, _BV(NEXT_HOUR) },
+    { { WORD_HALB, N, N }, _BV(NEXT_HOUR) },
+    { { WORD_FUENF, WORD_NACH, WORD_HALB }, _BV(NEXT_HOUR) },
+    { { WORD_ZEHN, WORD_NACH, WORD_HALB }, _BV(NEXT_HOUR) },
+    { { WORD_VIERTEL, WORD_VOR, N }, _BV(NEXT_HOUR) },
+    { { WORD_ZEHN, WORD_VOR, N }, _BV(NEXT_HOUR) },
+    { { WORD_FUENF, WORD_VOR, N }, _BV(NEXT_HOUR) },
+  },
+  {
+    { { N, N, N }, _BV(FULL_HOUR) },
+    { { WORD_FUENF, WORD_NACH, N }, 0 },
+    { { WORD_ZEHN, WORD_NACH, N }, 0 },
+    { { WORD_VIERTEL, N, N }, _BV(NEXT_HOUR) },
+    { { WORD_ZEHN, WORD_VOR, WORD_HALB }, _BV(NEXT_HOUR) },
+    { { WORD_FUENF, WORD_VOR, WORD_HALB }, _BV(NEXT_HOUR) },
+    { { WORD_HALB, N, N }, _BV(NEXT_HOUR) },
+    { { WORD_FUENF, WORD_NACH, WORD_HALB }, _BV(NEXT_HOUR) },
+    { { WORD_ZEHN, WORD_NACH, WORD_HALB }, _BV(NEXT_HOUR) },
+    { { WORD_VIERTEL, WORD_VOR, N }, _BV(NEXT_HOUR) },
+    { { WORD_ZEHN, WORD_VOR, N }, _BV(NEXT_HOUR) },
+    { { WORD_FUENF, WORD_VOR, N }, _BV(NEXT_HOUR) },
+  },
+};
+
+#undef N
+
+static void addWord(uint8_t word, uint16_t frame[]) {
+  frame[pgm_read_byte(&words[word].row)] |= pgm_read_word(&words[word].mask);
+}
+
+/*
+  Sets the rows of frame to the words for the given time, rounded down to
+  five minutes. hours must be below 12, frame must hold PHRASE_ROWS rows.
+*/
+void planPhrase(uint8_t hours, uint8_t minutes, uint8_t layout, uint16_t frame[]) {
+  if (layout >= LAYOUTS) {
+    layout = LAYOUT_STANDARD;
+  }
+  const phrase_t* phrase = &phrases[layout][minutes / 5];
+  uint8_t flags = pgm_read_byte(&phrase->flags);
+
+  for (uint8_t i = 0; i < PHRASE_ROWS; i += 1) {
+    frame[i] = 0;
+  }
+  addWord(WORD_ES, frame);
+  addWord(WORD_IST, frame);
+  for (uint8_t i = 0; i < PHRASE_WORDS; i += 1) {
+    uint8_t word = pgm_read_byte(&phrase->words[i]);
+    if (word == WORD_NONE) {
+      break;
+    }
+    addWord(word, frame);
+  }
+  if (flags & _BV(NEXT_HOUR)) {
+    hours = hours == 11 ? 0 : hours + 1;
+  }
+  if (flags & _BV(FULL_HOUR)) {
+    addWord(hours == 1 ? WORD_EIN : WORD_HOURS + hours, frame);
+    addWord(WORD_UHR, frame);
+  } else {
+    addWord(WORD_HOURS + hours, frame);
+  }
+}
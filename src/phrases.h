@@ -0,0 +1,30 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef __PHRASES_H_
+#define __PHRASES_H_
+
+#include <stdint.h>
+
+#define LAYOUT_STANDARD      0
+#define LAYOUT_ZEHN_VOR_HALB 1
+#define LAYOUT_VIERTEL       2
+#define LAYOUTS              3
+
+#define PHRASE_ROWS          9
+
+void planPhrase(uint8_t hours, uint8_t minutes, uint8_t layout, uint16_t frame[]);
+
+#endif
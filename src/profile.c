@@ -0,0 +1,56 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdint.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+#include "profile.h"
+
+volatile uint8_t profilePeriods;
+
+static volatile uint16_t profileMax[PROFILES];
+
+void endProfile(uint8_t profile, profile_t start) {
+  profile_t end = startProfile();
+  uint8_t periods = end.periods - start.periods;
+  uint32_t ticks = (uint32_t) periods * (OCR1A + 1) + end.count - start.count;
+  if (ticks > UINT16_MAX) {
+    ticks = UINT16_MAX;
+  }
+  if (ticks > profileMax[profile]) {
+    profileMax[profile] = ticks;
+  }
+}
+
+uint16_t getProfileMax(uint8_t profile) {
+  uint16_t result;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    result = profileMax[profile];
+  }
+  return result;
+}
+
+uint16_t getProfileCycles(uint8_t profile) {
+  uint32_t cycles = (uint32_t) getProfileMax(profile) * CYCLES_PER_TICK;
+  return cycles > UINT16_MAX ? UINT16_MAX : cycles;
+}
+
+void resetProfiles(void) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for (uint8_t i = 0; i < PROFILES; i += 1) {
+      profileMax[i] = 0;
+    }
+  }
+}
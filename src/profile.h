@@ -0,0 +1,72 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef __PROFILE_H_
+#define __PROFILE_H_
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#define PROFILE_MATRIX   0
+#define PROFILE_TIMER1   1
+#define PROFILE_TWI      2
+#define PROFILE_UART     3
+#define PROFILE_LOOP     4
+#define PROFILES         5
+
+#define CYCLES_PER_TICK  8
+
+/*
+  Timer1 runs at F_CPU / 8 and is used as the time base for profiling. A
+  profile starts at the count and the number of Timer1 periods, so that a
+  duration longer than the 10 ms period saturates instead of wrapping. TCNT1
+  is read atomically, because the main loop is profiled as well and a 16 bit
+  read shares the TEMP register with the ISRs.
+*/
+typedef struct {
+  uint16_t count;
+  uint8_t periods;
+} profile_t;
+
+extern volatile uint8_t profilePeriods;
+
+/* Called by the Timer1 compare ISR before anything is profiled in it. */
+static inline void countProfilePeriod(void) {
+  profilePeriods += 1;
+}
+
+static inline profile_t startProfile(void) {
+  profile_t start;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    start.count = TCNT1;
+    start.periods = profilePeriods;
+    if (bit_is_set(TIFR1, OCF1A) && start.count < OCR1A / 2) {
+      start.periods += 1;
+    }
+  }
+  return start;
+}
+
+void endProfile(uint8_t profile, profile_t start);
+
+uint16_t getProfileMax(uint8_t profile);
+
+/* Returns the longest duration in CPU cycles, saturated to 16 bits. */
+uint16_t getProfileCycles(uint8_t profile);
+
+void resetProfiles(void);
+
+#endif
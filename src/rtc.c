@@ -13,14 +13,17 @@
    See the License for the specific language governing permissions and
    limitations under the License.
 */
+#include <stdbool.h>
 #include <stdint.h>
 #include <avr/interrupt.h>
 #include <avr/io.h>
+#include <util/delay.h>
 #include <util/twi.h>
+#include "log.h"
+#include "profile.h"
 #include "rtc.h"
 #include "time.h"
 
-#define TWI_BITRATE    50000
 #define TWBR_VALUE     F_CPU / 2 / TWI_BITRATE - 8
 
 #define DS1307_ADDRESS 0b1101000
@@ -37,12 +40,39 @@
 
 #define BUFFER_SIZE    8
 
+#define DS1307_CH      7
+#define DS1307_CONTROL 7
+#define DS1307_SQW_1HZ 0x10
+
+#define SQW_DDR        DDRD
+#define SQW_PORT       PORTD
+#define SQW_PIN        PD2
+#define SQW_INPUT      PIND
+
+#define POLL_TIMEOUT   0xFFFF
+
+#define SCL_DDR        DDRC
+#define SCL_PIN        PC5
+#define SCL_PULSES     9
+#define SCL_DELAY_US   10
+
+#define TIMEOUT_TICKS  5
+#define MAX_FAILURES   3
+#define TWI_TIMEOUT    0xFF
+
 #define DEBUG_DDR       DDRD
 #define DEBUG_PORT      PORTD
 #define DEBUG_PIN       PD5
 
 volatile uint8_t buffer[BUFFER_SIZE] = {0, 0, 0, 0, 0, 0, 0, 0};
 volatile uint8_t state = STATE_IDLE;
+volatile bool running = true;
+volatile uint8_t firstRegister;
+static uint8_t busyTicks = 0;
+static volatile uint8_t failures = 0;
+static uint8_t lastError = TW_NO_INFO;
+static void (*squareWaveCallback)(void);
+static bool squareWaveHigh;
 void (*getTimeCallback)(time_t* time);
 
 static uint8_t toBcd(uint8_t value) {
@@ -56,7 +86,8 @@ static uint8_t fromBcd(uint8_t value) {
 static void decodeTime() {
   time_t time;
 
-  time.seconds = fromBcd(buffer[0]);
+  running = !(buffer[0] & _BV(DS1307_CH));
+  time.seconds = fromBcd(buffer[0] & ~_BV(DS1307_CH));
   time.minutes = fromBcd(buffer[1]);
   time.hours = fromBcd(buffer[2]);
   time.dayOfWeek = buffer[3];
@@ -67,16 +98,35 @@ static void decodeTime() {
   getTimeCallback(&time);
 }
 
-ISR(TWI_vect) {
+/*
+  A fault that persists would log the same error for every transfer and wear
+  out the log, so an error is only logged if it differs from the previous one
+  since the last completed transfer.
+*/
+static void logError(uint8_t error) {
+  if (error != lastError) {
+    logEvent(LOG_TWI_ERROR, error);
+    lastError = error;
+  }
+}
+
+static void completeTransfer() {
+  TWCR = TWI_STOP;
+  state = STATE_IDLE;
+  failures = 0;
+  lastError = TW_NO_INFO;
+}
+
+static void handleTwi() {
   static uint8_t bufferPos;
   uint8_t status = TW_STATUS;
 
   if (status == TW_START) {
     TWDR = (DS1307_ADDRESS << 1) | TW_WRITE;
     TWCR = TWI_WRITE;
-    bufferPos = 0;
+    bufferPos = firstRegister;
   } else if (status == TW_MT_SLA_ACK) {
-    TWDR = 0x00;
+    TWDR = firstRegister;
     TWCR = TWI_WRITE;
   } else if (status == TW_MT_DATA_ACK) {
     if (state == STATE_WRITE) {
@@ -85,8 +135,7 @@ ISR(TWI_vect) {
 	TWCR = TWI_WRITE;
 	bufferPos += 1;
       } else {
-	TWCR = TWI_STOP;
-	state = STATE_IDLE;
+	completeTransfer();
       }
     } else if (state == STATE_READ) {
       TWCR = TWI_START;
@@ -106,23 +155,71 @@ ISR(TWI_vect) {
     }
   } else if (status == TW_MR_DATA_NACK) {
     buffer[bufferPos] = TWDR;
-    TWCR = TWI_STOP;
-    state = STATE_IDLE;
+    completeTransfer();
     decodeTime();
   } else {
     DEBUG_PORT |= _BV(DEBUG_PIN);
+    logError(status);
     TWCR = TWI_STOP;
     state = STATE_IDLE;
   }
 }
 
+ISR(TWI_vect) {
+  profile_t profile = startProfile();
+  handleTwi();
+  endProfile(PROFILE_TWI, profile);
+}
+
+/*
+  The SQW output falls when the DS1307 advances its seconds register. A pin
+  change interrupt is used instead of INT0, because unlike an edge triggered
+  INT0 it also wakes the MCU from power-save mode. Other pins of the port may
+  share the interrupt, so only a change of SQW from high to low counts.
+*/
+ISR(PCINT2_vect) {
+  bool high = bit_is_set(SQW_INPUT, SQW_PIN);
+  if (squareWaveHigh && !high && squareWaveCallback) {
+    squareWaveCallback();
+  }
+  squareWaveHigh = high;
+}
+
+static void pollTwi() {
+  uint16_t timeout = POLL_TIMEOUT;
+
+  while (state != STATE_IDLE) {
+    if (bit_is_set(TWCR, TWINT)) {
+      handleTwi();
+      timeout = POLL_TIMEOUT;
+    } else if (--timeout == 0) {
+      TWCR = 0;
+      state = STATE_IDLE;
+    }
+  }
+}
+
 void initRtc() {
   TWBR = TWBR_VALUE;
 }
 
-void writeTime(time_t* time) {
+void initSquareWave(void (*callback)(void)) {
+  SQW_PORT |= _BV(SQW_PIN);
+  squareWaveCallback = callback;
+  squareWaveHigh = bit_is_set(SQW_INPUT, SQW_PIN);
+  PCMSK2 |= _BV(PCINT18);
+  PCICR |= _BV(PCIE2);
+
+  buffer[DS1307_CONTROL] = DS1307_SQW_1HZ;
+  firstRegister = DS1307_CONTROL;
+  state = STATE_WRITE;
+  TWCR = TWI_START;
+  pollTwi();
+}
+
+bool writeTime(time_t* time) {
   if (state != STATE_IDLE) {
-    return;
+    return false;
   }
 
   buffer[0] = toBcd(time->seconds);
@@ -132,17 +229,74 @@ void writeTime(time_t* time) {
   buffer[4] = toBcd(time->day);
   buffer[5] = toBcd(time->month);
   buffer[6] = toBcd(time->year);
-  buffer[7] = 0x00;
+  buffer[7] = DS1307_SQW_1HZ;
+  running = true;
+  firstRegister = 0;
   state = STATE_WRITE;
   TWCR = TWI_START;
+  return true;
 }
 
-void readTime(void (*callback)(time_t* time)) {
+bool readTime(void (*callback)(time_t* time)) {
   if (state != STATE_IDLE) {
-    return;
+    return false;
   }
 
   state = STATE_READ;
-  TWCR = TWI_START;
+  firstRegister = 0;
   getTimeCallback = callback;
+  TWCR = TWI_START;
+  return true;
+}
+
+/*
+  Called from the Timer1 ISR on every tick. A transfer that has not completed
+  after TIMEOUT_TICKS is aborted, and the bus is released by clocking SCL in
+  case the DS1307 holds SDA low in the middle of a byte. PORTC5 is never set,
+  so switching SCL to an output pulls it low.
+*/
+void superviseTwi() {
+  if (state == STATE_IDLE) {
+    busyTicks = 0;
+    return;
+  }
+  busyTicks += 1;
+  if (busyTicks < TIMEOUT_TICKS) {
+    return;
+  }
+  logError(TWI_TIMEOUT);
+  TWCR = 0;
+  for (uint8_t i = 0; i < SCL_PULSES; i += 1) {
+    SCL_DDR |= _BV(SCL_PIN);
+    _delay_us(SCL_DELAY_US);
+    SCL_DDR &= ~_BV(SCL_PIN);
+    _delay_us(SCL_DELAY_US);
+  }
+  busyTicks = 0;
+  state = STATE_IDLE;
+  if (failures < UINT8_MAX) {
+    failures += 1;
+  }
+}
+
+/*
+  The TWI is considered dead after MAX_FAILURES transfers in a row have timed
+  out, so that the watchdog resets the MCU. Transfers that end with an error
+  status do not count, the bus still works then.
+*/
+bool isTwiAlive() {
+  return failures < MAX_FAILURES;
+}
+
+bool isRtcIdle() {
+  return state == STATE_IDLE;
+}
+
+bool isRtcRunning() {
+  return running;
+}
+
+void readTimeNow(void (*callback)(time_t* time)) {
+  readTime(callback);
+  pollTwi();
 }
@@ -16,13 +16,33 @@
 #ifndef __RTC_H_
 #define __RTC_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 #include "time.h"
 
+#define TWI_BITRATE    50000
+
+/* The time from writeTime until the DS1307 acknowledges the seconds: a start condition and three bytes. */
+#define RTC_WRITE_US   ((1 + 3 * 9) * 1000000UL / TWI_BITRATE)
+
 void initRtc();
 
-void writeTime(time_t* time);
+/* Enables the 1 Hz SQW output by polling the TWI, to be used while interrupts are disabled. */
+void initSquareWave(void (*callback)(void));
+
+bool writeTime(time_t* time);
+
+bool readTime(void (*callback)(time_t* time));
+
+/* Reads the time by polling the TWI, to be used while interrupts are disabled. */
+void readTimeNow(void (*callback)(time_t* time));
+
+void superviseTwi();
+
+bool isTwiAlive();
+
+bool isRtcIdle();
 
-void readTime(void (*callback)(time_t* time));
+bool isRtcRunning();
 
 #endif
@@ -0,0 +1,104 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/eeprom.h>
+#include <avr/io.h>
+#include "schedule.h"
+#include "storage.h"
+#include "time.h"
+
+#define MINUTES_PER_HOUR 60
+#define MINUTES_PER_DAY  1440
+#define NO_RULE          0xFF
+
+typedef char check_rule_size[sizeof(rule_t) == RULE_SIZE ? 1 : -1];
+typedef char check_schedule_size[RULES * RULE_SIZE <= SCHEDULE_SIZE ? 1 : -1];
+
+/*
+  The active rule only changes when the time of day crosses a rule boundary or
+  the day changes. Each evaluation remembers the next boundary, so between
+  boundaries updateSchedule does a single comparison and does not touch the
+  EEPROM.
+*/
+static bool dirty = true;
+static uint8_t day;
+static uint16_t lastMinute;
+static uint16_t nextChange;
+static uint8_t active = NO_RULE;
+static rule_t activeRule;
+
+static rule_t* getRuleAddress(uint8_t index) {
+  return (rule_t*) (SCHEDULE_ADDRESS + index * RULE_SIZE);
+}
+
+static bool isRuleActive(const rule_t* rule, uint8_t dayOfWeek, uint16_t minute) {
+  if (dayOfWeek && !(rule->days & _BV(dayOfWeek - 1))) {
+    return false;
+  }
+  if (rule->start < rule->end) {
+    return minute >= rule->start && minute < rule->end;
+  } else if (rule->start > rule->end) {
+    return minute >= rule->start || minute < rule->end;
+  }
+  return true;
+}
+
+void readRule(uint8_t index, rule_t* rule) {
+  eeprom_read_block(rule, getRuleAddress(index), sizeof(rule_t));
+}
+
+void writeRule(uint8_t index, const rule_t* rule) {
+  eeprom_update_block(rule, getRuleAddress(index), sizeof(rule_t));
+  dirty = true;
+}
+
+bool updateSchedule(const time_t* time) {
+  uint16_t minute = time->hours * MINUTES_PER_HOUR + time->minutes;
+  if (!dirty && time->dayOfWeek == day && minute >= lastMinute && minute < nextChange) {
+    lastMinute = minute;
+    return false;
+  }
+
+  uint8_t previous = active;
+  dirty = false;
+  day = time->dayOfWeek;
+  lastMinute = minute;
+  nextChange = MINUTES_PER_DAY;
+  active = NO_RULE;
+  for (uint8_t i = 0; i < RULES; i += 1) {
+    rule_t rule;
+    readRule(i, &rule);
+    if (rule.days & _BV(RULE_UNUSED)) {
+      continue;
+    }
+    if (rule.start > minute && rule.start < nextChange) {
+      nextChange = rule.start;
+    }
+    if (rule.end > minute && rule.end < nextChange) {
+      nextChange = rule.end;
+    }
+    if (active == NO_RULE && isRuleActive(&rule, day, minute)) {
+      active = i;
+      activeRule = rule;
+    }
+  }
+  return active != previous || active != NO_RULE;
+}
+
+const rule_t* getActiveRule(void) {
+  return active == NO_RULE ? 0 : &activeRule;
+}
@@ -0,0 +1,58 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef __SCHEDULE_H_
+#define __SCHEDULE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "time.h"
+
+#define RULES          8
+#define RULE_SIZE      8
+
+#define RULE_UNUSED    7
+
+#define RULE_BLANK     0
+#define RULE_FLASH     1
+#define RULE_KEEP_BRIGHTNESS 2
+
+#define EFFECT_KEEP    0xFF
+
+/*
+  days holds one bit per day of the week, bit 0 being day 1. start and end
+  are minutes of the day; a window with end before start spans midnight and a
+  window with end equal to start covers the whole day. Every brightness is a
+  valid value, so a rule that keeps the configured brightness is marked with
+  RULE_KEEP_BRIGHTNESS instead.
+*/
+typedef struct {
+  uint8_t days;
+  uint16_t start;
+  uint16_t end;
+  uint8_t brightness;
+  uint8_t effect;
+  uint8_t flags;
+} rule_t;
+
+void readRule(uint8_t index, rule_t* rule);
+
+void writeRule(uint8_t index, const rule_t* rule);
+
+bool updateSchedule(const time_t* time);
+
+const rule_t* getActiveRule(void);
+
+#endif
@@ -0,0 +1,109 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include "settings.h"
+#include "storage.h"
+
+#define SETTINGS_VERSION 1
+
+#define SLOTS            2
+#define SLOT_SIZE        (SETTINGS_SIZE / SLOTS)
+#define DATA_SIZE        (SLOT_SIZE - 4)
+
+typedef struct {
+  uint8_t version;
+  uint8_t generation;
+  uint8_t data[DATA_SIZE];
+  uint16_t crc;
+} record_t;
+
+typedef char check_record_size[sizeof(record_t) == SLOT_SIZE ? 1 : -1];
+typedef char check_data_size[sizeof(settings_t) <= DATA_SIZE ? 1 : -1];
+
+settings_t settings = {
+  .brightness = 0xFF,
+};
+
+/*
+  The settings are stored in two slots. A commit always overwrites the slot
+  which does not hold the current settings and bumps the generation, so a
+  power loss during a commit leaves the previous record intact. At boot the
+  valid record with the newest generation wins.
+*/
+static uint8_t active_slot = SLOTS - 1;
+static uint8_t generation = 0;
+
+static record_t* getSlotAddress(uint8_t slot) {
+  return (record_t*) (SETTINGS_ADDRESS + slot * SLOT_SIZE);
+}
+
+static uint16_t getCrc(record_t* record) {
+  uint16_t crc = 0xFFFF;
+  uint8_t* data = (uint8_t*) record;
+  for (uint8_t i = 0; i < offsetof(record_t, crc); i += 1) {
+    crc = _crc16_update(crc, data[i]);
+  }
+  return crc;
+}
+
+static bool readRecord(uint8_t slot, record_t* record) {
+  eeprom_read_block(record, getSlotAddress(slot), sizeof(record_t));
+  return record->version == SETTINGS_VERSION && record->crc == getCrc(record);
+}
+
+void loadSettings(void) {
+  record_t record;
+  bool found = false;
+
+  for (uint8_t i = 0; i < SLOTS; i += 1) {
+    if (readRecord(i, &record) && (!found || (int8_t) (record.generation - generation) > 0)) {
+      memcpy(&settings, record.data, sizeof(settings_t));
+      generation = record.generation;
+      active_slot = i;
+      found = true;
+    }
+  }
+}
+
+void saveSettings(void) {
+  record_t record;
+
+  memset(&record, 0, sizeof(record_t));
+  record.version = SETTINGS_VERSION;
+  record.generation = generation + 1;
+  memcpy(record.data, &settings, sizeof(settings_t));
+  record.crc = getCrc(&record);
+
+  active_slot = (active_slot + 1) % SLOTS;
+  generation = record.generation;
+  eeprom_update_block(&record, getSlotAddress(active_slot), sizeof(record_t));
+}
+
+uint8_t getSetting(uint8_t key) {
+  return ((uint8_t*) &settings)[key];
+}
+
+void setSetting(uint8_t key, uint8_t value) {
+  if (key < SETTINGS_COUNT && getSetting(key) != value) {
+    ((uint8_t*) &settings)[key] = value;
+    saveSettings();
+  }
+}
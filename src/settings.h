@@ -0,0 +1,51 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef __SETTINGS_H_
+#define __SETTINGS_H_
+
+#include <stdint.h>
+
+/*
+  Fields are only ever appended. A record written by an older firmware reads
+  the new fields as zero, so zero must select the previous behaviour.
+*/
+typedef struct {
+  uint8_t brightness;
+  uint8_t gamma;
+  uint8_t layout;
+  uint8_t baud;
+  uint8_t osccal;
+  uint8_t refresh;
+  uint8_t sync;
+  uint8_t effect;
+  uint8_t dots;
+  uint8_t budget;
+  uint8_t thermal;
+} settings_t;
+
+#define SETTINGS_COUNT sizeof(settings_t)
+
+extern settings_t settings;
+
+void loadSettings(void);
+
+void saveSettings(void);
+
+uint8_t getSetting(uint8_t key);
+
+void setSetting(uint8_t key, uint8_t value);
+
+#endif
@@ -0,0 +1,57 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdint.h>
+#include "stack.h"
+
+#define STACK_CANARY 0xC5
+
+extern uint8_t _end;
+extern uint8_t __stack;
+
+/*
+  Fills the RAM between the end of .bss and the top of the stack with a
+  canary before the C runtime starts. It runs from .init1, where neither the
+  stack pointer nor r1 are set up, so it must not be called.
+*/
+void paintStack(void) __attribute__ ((naked, used, section (".init1")));
+
+void paintStack(void) {
+  __asm__ __volatile__ (
+    "  ldi r30, lo8(_end)\n"
+    "  ldi r31, hi8(_end)\n"
+    "  ldi r24, %0\n"
+    "  ldi r25, hi8(__stack)\n"
+    "  rjmp 2f\n"
+    "1:\n"
+    "  st Z+, r24\n"
+    "2:\n"
+    "  cpi r30, lo8(__stack)\n"
+    "  cpc r31, r25\n"
+    "  brlo 1b\n"
+    "  breq 1b\n"
+    :: "M" (STACK_CANARY));
+}
+
+/*
+  Returns the number of stack bytes that have never been used since reset.
+*/
+uint16_t getStackFree(void) {
+  const uint8_t* p = &_end;
+  while (p <= &__stack && *p == STACK_CANARY) {
+    p += 1;
+  }
+  return p - &_end;
+}
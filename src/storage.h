@@ -0,0 +1,38 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef __STORAGE_H_
+#define __STORAGE_H_
+
+/* EEPROM layout. Addresses are fixed so that a firmware update keeps the data. */
+
+#define SETTINGS_ADDRESS 0x000
+#define SETTINGS_SIZE    0x020
+
+#define SCHEDULE_ADDRESS 0x040
+#define SCHEDULE_SIZE    0x040
+
+#define OSCCAL_ADDRESS   0x0FB
+
+#define BOOT_ADDRESS     0x0FC
+#define BOOT_SIZE        0x004
+#define BOOT_REQUEST     (BOOT_ADDRESS + 3)
+
+#define BOOT_REQUEST_UPDATE 0x01
+
+#define LOG_ADDRESS      0x100
+#define LOG_SIZE         0x100
+
+#endif
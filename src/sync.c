@@ -0,0 +1,78 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "sync.h"
+#include "time.h"
+#include "uart.h"
+
+#define FRAME_BITS       ((1 + SYNC_LENGTH + 2) * 10UL)
+#define LEAD_US          10000UL
+#define WINDOW_US        10000UL
+#define US_PER_SECOND    1000000UL
+
+/*
+  A sync frame announces the time of the next second and is sent so that it
+  ends at least LEAD_US before that second starts, which leaves the receiver
+  a pass of its main loop to get to the frame. It carries the remaining delay
+  in SYNC_UNIT_US, measured by the sender right before the frame is queued,
+  so the receiver only has to wait that long after the frame ended and write
+  the time to its RTC. Writing the seconds register restarts the DS1307
+  divider chain, which aligns the sub-second phase as well.
+*/
+static uint32_t transmitTime;
+
+typedef char check_delay_size[(LEAD_US + WINDOW_US) / SYNC_UNIT_US <= UINT8_MAX ? 1 : -1];
+
+static const uint32_t baudRates[] = { 9600, 19200, 38400, 57600 };
+
+void initSync(uint8_t baud) {
+  if (baud >= sizeof(baudRates) / sizeof(baudRates[0])) {
+    baud = UART_BAUD_9600;
+  }
+  transmitTime = FRAME_BITS * US_PER_SECOND / baudRates[baud];
+}
+
+bool isSyncDue(uint32_t elapsed) {
+  uint32_t end = US_PER_SECOND - transmitTime - LEAD_US;
+  return elapsed >= end - WINDOW_US && elapsed < end;
+}
+
+/*
+  The frame is formatted before the elapsed time is read, so that the delay
+  it carries only misses the time it takes to queue the first byte.
+*/
+void sendSync(const time_t* time, uint32_t (*getElapsed)(void)) {
+  char frame[SYNC_LENGTH - 1];
+  sprintf(frame, "%02d%02d%02d%02d%02d%02d%1d", time->year, time->month, time->day, time->hours, time->minutes, time->seconds + 1, time->dayOfWeek);
+
+  uint32_t end = getElapsed() + transmitTime;
+  uint32_t delay = end < US_PER_SECOND ? (US_PER_SECOND - end + SYNC_UNIT_US / 2) / SYNC_UNIT_US : 0;
+  uart_putc(COMMAND_SYNC);
+  uart_puts(frame);
+  uart_puthex(delay < UINT8_MAX ? delay : UINT8_MAX);
+  uart_puts("\r\n");
+}
+
+bool receiveSync(const char argument[], uint8_t argument_length, time_t* time, uint8_t* delay) {
+  if (argument_length != SYNC_LENGTH) {
+    return false;
+  }
+  return uart_parsedec(argument, 2, &time->year) && uart_parsedec(argument + 2, 2, &time->month) && uart_parsedec(argument + 4, 2, &time->day)
+    && uart_parsedec(argument + 6, 2, &time->hours) && uart_parsedec(argument + 8, 2, &time->minutes) && uart_parsedec(argument + 10, 2, &time->seconds)
+    && uart_parsedec(argument + 12, 1, &time->dayOfWeek) && uart_parsehex(argument + 13, delay);
+}
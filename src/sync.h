@@ -0,0 +1,41 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef __SYNC_H_
+#define __SYNC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "time.h"
+
+#define SYNC_OFF         0
+#define SYNC_MASTER      1
+#define SYNC_FOLLOWER    2
+
+#define COMMAND_SYNC     'z'
+
+#define SYNC_SECOND      30
+#define SYNC_LENGTH      15
+#define SYNC_UNIT_US     100
+
+void initSync(uint8_t baud);
+
+bool isSyncDue(uint32_t elapsed);
+
+void sendSync(const time_t* time, uint32_t (*getElapsed)(void));
+
+bool receiveSync(const char argument[], uint8_t argument_length, time_t* time, uint8_t* delay);
+
+#endif
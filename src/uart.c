@@ -17,26 +17,64 @@
 #include <stdint.h>
 #include <avr/interrupt.h>
 #include <avr/io.h>
+#include <util/atomic.h>
+#include "log.h"
+#include "profile.h"
 #include "uart.h"
 
-#define BAUD 9600
-#include <util/setbaud.h>
-
 #define BUFFER_SIZE 16
 
+#define RXD_INPUT   PIND
+#define RXD_PIN     PD0
+
+#define UBRR_VALUE(baud) ((F_CPU + 4UL * (baud)) / (8UL * (baud)) - 1)
+
+static const uint16_t ubrrValues[] = {
+  UBRR_VALUE(9600),
+  UBRR_VALUE(19200),
+  UBRR_VALUE(38400),
+  UBRR_VALUE(57600),
+};
+
 volatile static uint8_t rx_buffer[BUFFER_SIZE];
 volatile static uint8_t rx_head = 0;
 volatile static uint8_t rx_tail = 0;
 volatile static uint8_t tx_buffer[BUFFER_SIZE];
 volatile static uint8_t tx_head = 0;
 volatile static uint8_t tx_tail = 0;
+volatile static uint16_t rx_dropped = 0;
+volatile static uint16_t rx_lost = 0;
+volatile static uint32_t rx_line_time = 0;
+static uint32_t (*rx_clock)(void) = 0;
+static bool lost = false;
+
+typedef char check_lost_size[BUFFER_SIZE <= 16 ? 1 : -1];
 
 ISR(USART_RX_vect) {
+  static bool overflow = false;
+  static uint8_t last = 0;
+  profile_t profile = startProfile();
   uint8_t tmp_head = (rx_head + 1) % BUFFER_SIZE;
+  uint8_t c = UDR0;
+  if (rx_clock && last == '\r' && c == '\n') {
+    rx_line_time = rx_clock();
+  }
+  last = c;
   if (tmp_head != rx_tail) {
-    rx_buffer[rx_head] = UDR0;
+    rx_buffer[rx_head] = c;
     rx_head = tmp_head;
+    overflow = false;
+  } else {
+    rx_lost |= (uint16_t) 1 << rx_head;
+    if (rx_dropped < UINT16_MAX) {
+      rx_dropped += 1;
+    }
+    if (!overflow) {
+      logEvent(LOG_UART_OVERFLOW, c);
+      overflow = true;
+    }
   }
+  endProfile(PROFILE_UART, profile);
 }
 
 ISR(USART_UDRE_vect) {
@@ -49,24 +87,117 @@ ISR(USART_UDRE_vect) {
   }
 }
 
-void uart_init(){
-  UBRR0H = UBRRH_VALUE;
-  UBRR0L = UBRRL_VALUE;
+void uart_init(uint8_t baud) {
+  if (baud >= sizeof(ubrrValues) / sizeof(ubrrValues[0])) {
+    baud = UART_BAUD_9600;
+  }
+  UBRR0H = ubrrValues[baud] >> 8;
+  UBRR0L = ubrrValues[baud];
+  UCSR0A = _BV(U2X0);
   UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
   UCSR0B = _BV(RXCIE0) | _BV(RXEN0) | _BV(TXEN0);
 }
 
+/*
+  The USART is stopped in power-save mode. With the wake-up enabled, a start
+  bit on RXD wakes the MCU through PCINT16 instead, and the byte is lost.
+*/
+void uart_wake(bool enable) {
+  if (enable) {
+    PCMSK2 |= _BV(PCINT16);
+    PCICR |= _BV(PCIE2);
+  } else {
+    PCMSK2 &= ~_BV(PCINT16);
+  }
+}
+
+/*
+  Returns true while RXD is low, i.e. during a start bit. Right after a
+  wake-up this tells whether RXD caused it.
+*/
+bool uart_rx_started(void) {
+  return bit_is_clear(RXD_INPUT, RXD_PIN);
+}
+
+/*
+  Makes the RX ISR read the given clock whenever a line ends with CR LF, for
+  commands that must act a given time after they were sent.
+*/
+void uart_stamp_lines(uint32_t (*clock)(void)) {
+  rx_clock = clock;
+}
+
+/*
+  Returns the clock at the end of the last line, which is the line being
+  executed while no other line has ended since.
+*/
+uint32_t uart_line_time(void) {
+  uint32_t time;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    time = rx_line_time;
+  }
+  return time;
+}
+
 bool uart_has_data(void) {
   return rx_head != rx_tail;
 }
 
+bool uart_tx_idle(void) {
+  return tx_head == tx_tail;
+}
+
+/*
+  Returns false if bytes are waiting to be sent but none has been sent since
+  the previous call.
+*/
+bool uart_tx_alive(void) {
+  static uint8_t last_tail = 0;
+  uint8_t tail = tx_tail;
+  bool alive = tx_head == tail || tail != last_tail;
+  last_tail = tail;
+  return alive;
+}
+
+/*
+  Returns the number of received bytes that were dropped because the buffer
+  was full, saturating at UINT16_MAX.
+*/
+uint16_t uart_dropped(void) {
+  uint16_t dropped;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    dropped = rx_dropped;
+  }
+  return dropped;
+}
+
+/*
+  Returns 0 if no data is available.
+*/
 uint8_t uart_getc(void) {
+  if (rx_head == rx_tail) {
+    return 0;
+  }
   uint8_t tmp_tail = (rx_tail + 1) % BUFFER_SIZE;
   uint8_t c = rx_buffer[rx_tail];
+  uint16_t mask = (uint16_t) 1 << rx_tail;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    lost = rx_lost & mask;
+    rx_lost &= ~mask;
+  }
   rx_tail = tmp_tail;
   return c;
 }
 
+/*
+  Returns true if bytes were dropped right before the byte last returned by
+  uart_getc. A full buffer drops the bytes that would follow its newest one,
+  so rx_lost marks the free slot the next byte is stored in.
+*/
+bool uart_lost(void) {
+  return lost;
+}
+
 void uart_putc(const uint8_t c) {
   uint8_t tmp_head = (tx_head + 1) % BUFFER_SIZE;
   while (tmp_head == tx_tail);
@@ -81,3 +212,46 @@ void uart_puts(const char* s) {
     s++;
   }
 }
+
+void uart_puthex(const uint8_t value) {
+  static const char digits[] = "0123456789ABCDEF";
+  uart_putc(digits[value >> 4]);
+  uart_putc(digits[value & 0x0F]);
+}
+
+/*
+  Parses two hex digits of a command argument. The value is left unchanged
+  if a character is not a hex digit.
+*/
+bool uart_parsehex(const char* s, uint8_t* value) {
+  uint8_t result = 0;
+  for (uint8_t i = 0; i < 2; i += 1) {
+    char c = s[i];
+    result <<= 4;
+    if (c >= '0' && c <= '9') {
+      result |= c - '0';
+    } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+      result |= (c | 0x20) - 'a' + 10;
+    } else {
+      return false;
+    }
+  }
+  *value = result;
+  return true;
+}
+
+/*
+  Parses the given number of decimal digits of a command argument. The value
+  is left unchanged if a character is not a digit.
+*/
+bool uart_parsedec(const char* s, uint8_t digits, uint8_t* value) {
+  uint8_t result = 0;
+  for (uint8_t i = 0; i < digits; i += 1) {
+    if (s[i] < '0' || s[i] > '9') {
+      return false;
+    }
+    result = result * 10 + s[i] - '0';
+  }
+  *value = result;
+  return true;
+}
@@ -19,14 +19,41 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-void uart_init();
+#define UART_BAUD_9600  0
+#define UART_BAUD_19200 1
+#define UART_BAUD_38400 2
+#define UART_BAUD_57600 3
+
+void uart_init(uint8_t baud);
+
+void uart_wake(bool enable);
+
+bool uart_rx_started(void);
+
+void uart_stamp_lines(uint32_t (*clock)(void));
+
+uint32_t uart_line_time(void);
 
 bool uart_has_data(void);
 
+bool uart_tx_idle(void);
+
+bool uart_tx_alive(void);
+
+uint16_t uart_dropped(void);
+
 uint8_t uart_getc(void);
 
+bool uart_lost(void);
+
 void uart_putc(uint8_t c);
 
 void uart_puts(const char* s);
 
+void uart_puthex(uint8_t value);
+
+bool uart_parsehex(const char* s, uint8_t* value);
+
+bool uart_parsedec(const char* s, uint8_t digits, uint8_t* value);
+
 #endif
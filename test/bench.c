@@ -0,0 +1,201 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "host.h"
+
+/*
+  main.c and dcf77.c are built into this harness, so that their static
+  functions can be timed. The output functions of uart.c are wrapped to drain
+  the transmit buffer right away, like the USART at a high baud rate, because
+  nothing else empties it while a function is timed.
+*/
+#pragma pack(push, 1)
+#include "dcf77.c"
+#define main firmwareMain
+#define uart_putc drainPutc
+#define uart_puts drainPuts
+#define uart_puthex drainPuthex
+#include "main.c"
+#undef main
+#undef uart_putc
+#undef uart_puts
+#undef uart_puthex
+#pragma pack(pop)
+
+void uart_putc(const uint8_t c);
+
+void uart_puthex(const uint8_t value);
+
+void USART_RX_vect(void);
+
+void USART_UDRE_vect(void);
+
+/*
+  Times the functions that make bench also reports AVR cycle counts for,
+  with realistic inputs, and prints one tab separated line per function:
+
+      function  calls  ns/op
+
+  ns/op is the fastest of several batches, which is the one least disturbed
+  by the host. The numbers are host times, only to compare commits on the
+  same machine, and the harness is built with optimization and without the
+  sanitizers of make test.
+*/
+
+#define BATCHES     5
+#define TICKS       100
+#define DCF77_TICKS (60 * TICKS)
+
+static volatile uint16_t sink;
+static uint8_t dcf77Signal[DCF77_TICKS];
+
+static void drain(void) {
+  while (UCSR0B & _BV(UDRIE0)) {
+    USART_UDRE_vect();
+  }
+}
+
+void drainPutc(const uint8_t c) {
+  uart_putc(c);
+  drain();
+}
+
+void drainPuts(const char* s) {
+  while (*s) {
+    drainPutc(*s);
+    s++;
+  }
+}
+
+void drainPuthex(const uint8_t value) {
+  uart_puthex(value);
+  drain();
+}
+
+static void report(const char* name, uint32_t calls, uint64_t fastest) {
+  printf("%s\t%lu\t%.1f\n", name, (unsigned long) calls, (double) fastest / calls);
+}
+
+#define BENCH(name, calls, body) { \
+    uint64_t fastest = UINT64_MAX; \
+    for (uint8_t batch = 0; batch < BATCHES; batch += 1) { \
+      uint64_t start = hostNanoseconds(); \
+      for (uint32_t call = 0; call < (calls); call += 1) { \
+        body; \
+      } \
+      uint64_t elapsed = hostNanoseconds() - start; \
+      if (elapsed < fastest) { \
+        fastest = elapsed; \
+      } \
+    } \
+    report(name, calls, fastest); \
+  }
+
+static void setBcd(uint8_t* bits, uint8_t from, uint8_t to, uint8_t value, int8_t parity) {
+  uint8_t bcd = value / 10 << 4 | value % 10;
+  uint8_t ones = 0;
+  for (uint8_t i = from; i <= to; i += 1) {
+    bits[i] = bcd >> (i - from) & 1;
+    ones += bits[i];
+  }
+  if (parity >= 0) {
+    bits[parity] = ones % 2;
+  }
+}
+
+/*
+  The DCF77 signal of one minute at 23:58 on Friday, 31.12.21, one level per
+  10 ms tick: 100 ms pulses for 0 and 200 ms pulses for 1, and no pulse in
+  the last second, which marks the start of the next minute.
+*/
+static void planDcf77Signal(void) {
+  uint8_t bits[59];
+  memset(bits, 0, sizeof(bits));
+  bits[20] = 1;
+  setBcd(bits, 21, 27, 58, 28);
+  setBcd(bits, 29, 34, 23, 35);
+  setBcd(bits, 36, 41, 31, -1);
+  setBcd(bits, 42, 44, 5, -1);
+  setBcd(bits, 45, 49, 12, -1);
+  setBcd(bits, 50, 57, 21, -1);
+  uint8_t ones = 0;
+  for (uint8_t i = 36; i < 58; i += 1) {
+    ones += bits[i];
+  }
+  bits[58] = ones % 2;
+  memset(dcf77Signal, 0, sizeof(dcf77Signal));
+  for (uint8_t second = 0; second < 59; second += 1) {
+    memset(dcf77Signal + second * TICKS, 1, bits[second] ? 20 : 10);
+  }
+}
+
+static void trackSignal(uint32_t call, time_t* decoded, uint16_t* minutes) {
+  PIND = dcf77Signal[call % DCF77_TICKS] ? _BV(DCF77_DATA_PIN) : 0;
+  if (trackDcf77(decoded)) {
+    *minutes += 1;
+  }
+}
+
+int main(void) {
+  loadSettings();
+  initLog();
+  uart_init(settings.baud);
+  initDcf77();
+  planDcf77Signal();
+  time.hours = 10;
+  time.minutes = 4;
+
+  printf("function\tcalls\tns/op\n");
+  BENCH("setMatrixData", 1000000, setMatrixData(call % ROWS, call % CHANNELS, call & 0xFFF));
+  BENCH("getGammaValue", 1000000, sink += getGammaValue(call));
+  BENCH("handleMatrix", 20000, { redraw = true; handleMatrix(); });
+  BENCH("advanceEffect", 1000000, {
+      if (!isEffectRunning()) {
+        startEffect(1 + call % (EFFECTS - 1));
+      }
+      advanceEffect();
+    });
+  startEffect(EFFECT_RAIN);
+  for (uint8_t i = 0; i < 100; i += 1) {
+    advanceEffect();
+  }
+  BENCH("getEffectPhase", 1000000, sink += getEffectPhase(call % ROWS, call % COLUMNS));
+  BENCH("blendCell", 1000000, sink += blendCell(call, call & 0x100 ? 0xFF : 0, 0xFF, call & 1, call >> 1));
+
+  time_t decoded;
+  uint16_t minutes = 0;
+  BENCH("trackDcf77", 20 * DCF77_TICKS, trackSignal(call, &decoded, &minutes));
+  if (minutes < BATCHES * 19 || decoded.hours != 23 || decoded.minutes != 58 || decoded.year != 21) {
+    printf("bench: trackDcf77 decoded %u minutes, the last as %02u:%02u %02u\n", minutes, decoded.hours,
+           decoded.minutes, decoded.year);
+    return 1;
+  }
+  BENCH("decodeDcf77", 1000000, decodeDcf77(&decoded));
+
+  BENCH("uart_getc", 1000000, { UDR0 = call; USART_RX_vect(); sink += uart_getc(); });
+  BENCH("uart_putc", 1000000, drainPutc(call));
+
+  static const char* const commands[] = { "v", "b", "t", "s05", "r", "e", "p", "f", "m" };
+  const uint8_t count = sizeof(commands) / sizeof(commands[0]);
+  BENCH("execute_command", 100000, {
+      const char* command = commands[call % count];
+      execute_command(command[0], command + 1, strlen(command + 1));
+    });
+  return 0;
+}
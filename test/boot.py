@@ -0,0 +1,317 @@
+#!/usr/bin/env python3
+#
+#   Copyright 2012 Daniel A. Spilker
+#
+#   Licensed under the Apache License, Version 2.0 (the "License");
+#   you may not use this file except in compliance with the License.
+#   You may obtain a copy of the License at
+#
+#       http://www.apache.org/licenses/LICENSE-2.0
+#
+#   Unless required by applicable law or agreed to in writing, software
+#   distributed under the License is distributed on an "AS IS" BASIS,
+#   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#   See the License for the specific language governing permissions and
+#   limitations under the License.
+#
+
+"""Runs tools/upload.py against a simulated bootloader.
+
+Usage: boot.py
+
+The simulated serial port carries the bytes at 250000 baud in simulated
+time, and the bootloader behind it follows boot/boot.c: it answers SYNC,
+collects frames into two buffers, checks their CRC, erases and writes each
+page while the next frame is received, and checks the CRC of the image and
+writes its record when the end frame arrives. The erase and write times of
+a page are the maxima from the ATmega88PA data sheet.
+
+A HEX image is uploaded once as it is, once with a byte corrupted on the
+line and once without the second buffer for comparison. The test fails
+unless every upload ends with the image in the flash, the right record in
+the EEPROM and the application started, and reports the time per KB.
+"""
+
+import contextlib
+import io
+import os
+import random
+import struct
+import sys
+import tempfile
+import types
+
+# upload.py only needs pyserial in main()
+sys.modules.setdefault('serial', types.ModuleType('serial'))
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'tools'))
+import upload  # noqa: E402
+
+BYTE_TIME = 10 / upload.BOOT_BAUD
+CLOCK = 8000000
+ERASE_TIME = 4.5e-3
+WRITE_TIME = 4.5e-3
+EEPROM_TIME = 3.3e-3
+# _crc16_update, the loop and the load of each byte
+CRC_CLOCKS = 20
+FRAME_SIZE = 2 + upload.PAGE_SIZE + 2
+TIMEOUT_BYTE = 1 / 50
+
+IMAGE_SIZE = 6000
+SEED = 1
+
+
+class Clock:
+    """Stands in for the time module in upload.py."""
+
+    def __init__(self):
+        self.now = 0.0
+
+    def time(self):
+        return self.now
+
+    def sleep(self, seconds):
+        self.now += seconds
+
+
+class Bootloader:
+    """Follows the main loop of boot/boot.c in simulated time."""
+
+    def __init__(self, overlap=True):
+        self.overlap = overlap
+        self.time = 0.0
+        self.flash = bytearray(b'\xff' * upload.PAGES * upload.PAGE_SIZE)
+        self.record = (0xFF, 0xFFFF)
+        self.synced = False
+        self.started = False
+        self.frames = [bytearray(FRAME_SIZE), bytearray(FRAME_SIZE)]
+        self.frame = 0
+        self.received = 0
+        self.last_byte = 0.0
+        self.programming = None
+        self.pending = None
+        self.buffer = None
+        self.erase_page = None
+        self.write_page = None
+        self.erased = None
+        self.written = None
+        self.invalidated = False
+        self.eeprom_ready = 0.0
+        self.input = []
+        self.output = []
+        self.naks = 0
+
+    def answer(self, byte):
+        self.output.append((self.time + BYTE_TIME, byte))
+        if byte == upload.NAK:
+            self.naks += 1
+
+    def start_page(self, index):
+        # boot_page_fill_safe waits for the EEPROM
+        self.time = max(self.time, self.eeprom_ready)
+        frame = self.frames[index]
+        self.buffer = bytes(frame[2:2 + upload.PAGE_SIZE])
+        self.erase_page = frame[1]
+        self.erased = self.time + ERASE_TIME
+        self.written = None
+        self.programming = index
+        if self.overlap:
+            self.answer(upload.ACK)
+
+    def handle_flash(self):
+        if self.written is None:
+            # boot_page_write takes the address from the frame buffer again
+            self.time = max(self.time, self.erased)
+            self.write_page = self.frames[self.programming][1]
+            self.flash[self.erase_page * upload.PAGE_SIZE:(self.erase_page + 1) * upload.PAGE_SIZE] = b'\xff' * upload.PAGE_SIZE
+            self.written = self.time + WRITE_TIME
+            return
+        self.time = max(self.time, self.written)
+        self.flash[self.write_page * upload.PAGE_SIZE:(self.write_page + 1) * upload.PAGE_SIZE] = self.buffer
+        self.programming = None
+        if not self.overlap:
+            self.answer(upload.ACK)
+        if self.pending is not None:
+            self.start_page(self.pending)
+            self.pending = None
+
+    def handle_frame(self):
+        frame = self.frames[self.frame]
+        self.time += FRAME_SIZE * CRC_CLOCKS / CLOCK
+        if struct.unpack('<H', frame[-2:])[0] != upload.crc16(frame[:-2]):
+            self.answer(upload.NAK)
+        elif frame[0] == upload.FRAME_PAGE:
+            if frame[1] >= upload.PAGES or self.pending is not None:
+                self.answer(upload.NAK)
+                return
+            if not self.invalidated:
+                self.time = max(self.time, self.eeprom_ready)
+                self.record = (0, self.record[1])
+                self.eeprom_ready = self.time + EEPROM_TIME
+                self.invalidated = True
+            if self.programming is not None:
+                self.pending = self.frame
+            else:
+                self.start_page(self.frame)
+            self.frame ^= 1
+        elif frame[0] == upload.FRAME_END:
+            while self.programming is not None:
+                self.handle_flash()
+            pages = frame[1]
+            crc = frame[2] | frame[3] << 8
+            self.time += pages * upload.PAGE_SIZE * CRC_CLOCKS / CLOCK
+            if not pages or pages > upload.PAGES or upload.crc16(self.flash[:pages * upload.PAGE_SIZE]) != crc:
+                self.answer(upload.NAK)
+                return
+            # eeprom_update_block only writes the bytes that change
+            old = struct.pack('<BH', *self.record)
+            new = struct.pack('<BH', pages, crc)
+            self.time = max(self.time, self.eeprom_ready)
+            self.time += EEPROM_TIME * sum(a != b for a, b in zip(old, new))
+            self.record = (pages, crc)
+            self.answer(upload.ACK)
+            self.started = True
+        else:
+            self.answer(upload.NAK)
+
+    def handle_byte(self, byte):
+        if not self.synced:
+            if byte == upload.SYNC:
+                self.synced = True
+                self.answer(upload.ACK)
+            return
+        if not self.received and byte == upload.SYNC:
+            return
+        self.frames[self.frame][self.received] = byte
+        self.received += 1
+        self.last_byte = self.time
+        if self.received == FRAME_SIZE:
+            self.received = 0
+            self.handle_frame()
+
+    def run(self, limit):
+        """Handles everything that happens up to the time limit."""
+        while not self.started:
+            events = []
+            if self.programming is not None:
+                events.append((self.erased if self.written is None else self.written, 'flash'))
+            if self.input:
+                events.append((max(self.time, self.input[0][0]), 'byte'))
+            if self.received:
+                events.append((self.last_byte + TIMEOUT_BYTE, 'timeout'))
+            if not events:
+                return
+            when, kind = min(events)
+            if when > limit:
+                return
+            if kind == 'flash':
+                self.handle_flash()
+            elif kind == 'byte':
+                self.time = when
+                self.handle_byte(self.input.pop(0)[1])
+            else:
+                self.time = when
+                self.received = 0
+                self.answer(upload.NAK)
+
+
+class Port:
+    """The serial port of upload.py, connected to the bootloader."""
+
+    def __init__(self, clock, bootloader, corrupt=None):
+        self.clock = clock
+        self.bootloader = bootloader
+        self.corrupt = corrupt
+        self.line = 0.0
+        self.sent = 0
+        self.timeout = 0.1
+
+    def write(self, data):
+        for byte in data:
+            self.line = max(self.line, self.clock.now) + BYTE_TIME
+            if self.sent == self.corrupt:
+                byte ^= 0x01
+            self.sent += 1
+            self.bootloader.input.append((self.line, byte))
+        self.clock.now = self.line
+        return len(data)
+
+    def read(self, size):
+        deadline = self.clock.now + self.timeout
+        self.bootloader.run(deadline)
+        output = self.bootloader.output
+        if not output or output[0][0] > deadline:
+            self.clock.now = deadline
+            return b''
+        when, byte = output.pop(0)
+        self.clock.now = max(self.clock.now, when)
+        return bytes([byte])
+
+    def reset_input_buffer(self):
+        self.bootloader.run(self.clock.now)
+        self.bootloader.output = [item for item in self.bootloader.output if item[0] > self.clock.now]
+
+
+def write_hex(file, image):
+    """Writes the image as Intel HEX records with a segment address record."""
+    def record(kind, address, data):
+        body = bytes([len(data), address >> 8, address & 0xFF, kind]) + data
+        file.write(':%s%02X\n' % (body.hex().upper(), -sum(body) & 0xFF))
+    half = 0x1000
+    for start in range(0, min(half, len(image)), 16):
+        record(0x00, start, image[start:min(start + 16, half)])
+    record(0x02, 0, bytes([half >> 12, 0]))
+    for start in range(half, len(image), 16):
+        record(0x00, start - half, image[start:start + 16])
+    record(0x01, 0, b'')
+
+
+def run(name, image, overlap=True, corrupt=None):
+    clock = Clock()
+    bootloader = Bootloader(overlap)
+    port = Port(clock, bootloader, corrupt)
+    upload.time = clock
+    with contextlib.redirect_stderr(io.StringIO()):
+        elapsed = upload.upload(port, image)
+    errors = []
+    pages = len(image) // upload.PAGE_SIZE
+    if bytes(bootloader.flash[:len(image)]) != image:
+        errors.append('the flash differs from the image')
+    if bootloader.record != (pages, upload.crc16(image)):
+        errors.append('the record is %s' % (bootloader.record,))
+    if not bootloader.started:
+        errors.append('the application was not started')
+    if corrupt is not None and not bootloader.naks:
+        errors.append('the corrupted frame was not rejected')
+    print('%-16s %5d  %5d  %4d  %7.1f  %6.1f' % (
+        name, len(image), pages, bootloader.naks, elapsed * 1000, elapsed * 1024000 / len(image)))
+    for error in errors:
+        print('  ' + error)
+    return not errors
+
+
+def main():
+    rng = random.Random(SEED)
+    data = bytes(rng.randrange(256) for _ in range(IMAGE_SIZE))
+    with tempfile.NamedTemporaryFile('w', suffix='.hex', delete=False) as file:
+        write_hex(file, data)
+    try:
+        image = upload.read_hex(file.name)
+    finally:
+        os.unlink(file.name)
+    if image[:len(data)] != data or len(image) % upload.PAGE_SIZE:
+        print('read_hex does not return the image')
+        sys.exit(1)
+
+    frame_time = FRAME_SIZE * BYTE_TIME
+    page_time = ERASE_TIME + WRITE_TIME
+    print('line %.2f ms per frame, flash %.2f ms per page' % (frame_time * 1000, page_time * 1000))
+    print('upload           bytes  pages  naks       ms   ms/KB')
+    ok = run('two buffers', image)
+    ok = run('corrupted byte', image, corrupt=5 * FRAME_SIZE + 20) and ok
+    ok = run('one buffer', image, overlap=False) and ok
+    if not ok:
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
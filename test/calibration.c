@@ -0,0 +1,127 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <avr/io.h>
+#include "calibration.h"
+#include "host.h"
+
+/*
+  Runs calibrateOscillator against a model of the RC oscillator for an hour
+  of square wave edges per case. The model steps the frequency by STEP per
+  OSCCAL value, and the upper range starts RANGE_OFFSET below where the lower
+  one ends, so that crossing from 0x7F to 0x80 makes the frequency jump. The
+  measured counts get a little noise. Each case runs in its own process, so
+  that it starts from the state after reset. Every case fails if OSCCAL leaves the
+  range it started in, or if the calibration that main.c would store changes
+  after it was first stored, which would wear out the EEPROM.
+*/
+
+#define SECONDS          3600
+#define COUNTS_PER_TICK  10001L
+#define STEP             0.005
+#define RANGE_OFFSET     0.25
+#define NOISE            200
+#define UPPER_START      (0x80 - RANGE_OFFSET / STEP)
+
+typedef struct {
+  const char* name;
+  uint8_t osccal;
+  double target;
+} case_t;
+
+/*
+  The target is the OSCCAL value in the lower range, possibly fractional or
+  beyond its end, that runs the oscillator at exactly F_CPU. A target half
+  way between two values is the one most likely to make the loop toggle.
+*/
+static const case_t cases[] = {
+  { "on a step", 0x30, 0x40 },
+  { "between steps", 0x30, 0x40 + 0.5 },
+  { "just off a step", 0x50, 0x40 + 0.45 },
+  { "beyond the lower range", 0x70, 0x7F + 4 },
+  { "below the upper range", 0x90, UPPER_START - 4 },
+};
+
+static uint32_t seed = 1;
+
+static double getFrequency(uint8_t osccal, double target) {
+  double steps = (osccal & 0x7F) - target + (osccal & 0x80 ? UPPER_START : 0);
+  return F_CPU * (1 + steps * STEP);
+}
+
+static int16_t getNoise(void) {
+  seed = seed * 1103515245 + 12345;
+  return (int16_t) ((seed >> 16) % (2 * NOISE + 1)) - NOISE;
+}
+
+static bool runCase(const case_t* test) {
+  OSCCAL = test->osccal;
+  double position = 0;
+  double measured = 0;
+  uint8_t stored = 0;
+  uint16_t changes = 0;
+  uint8_t lowest = OSCCAL;
+  uint8_t highest = OSCCAL;
+
+  for (uint16_t second = 0; second < SECONDS; second += 1) {
+    position += getFrequency(OSCCAL, test->target) / 8;
+    double next = position + getNoise();
+    uint32_t ticks = (uint32_t) (next / COUNTS_PER_TICK) - (uint32_t) (measured / COUNTS_PER_TICK);
+    measured = next;
+    calibrateOscillator(ticks, (uint32_t) measured % COUNTS_PER_TICK);
+    uint8_t calibration = getCalibration();
+    if (calibration && calibration != stored) {
+      changes += stored ? 1 : 0;
+      stored = calibration;
+    }
+    lowest = OSCCAL < lowest ? OSCCAL : lowest;
+    highest = OSCCAL > highest ? OSCCAL : highest;
+  }
+
+  double error = getFrequency(OSCCAL, test->target) / F_CPU - 1;
+  printf("calibration  %-24s  OSCCAL %02X..%02X, stored %02X, %u changes, error %+.2f%%\n", test->name, lowest,
+         highest, stored, changes, error * 100);
+  bool passed = true;
+  if ((lowest ^ highest) & 0x80) {
+    printf("calibration: OSCCAL crossed into the other range\n");
+    passed = false;
+  }
+  if (!stored || changes) {
+    printf("calibration: the stored value did not settle\n");
+    passed = false;
+  }
+  return passed;
+}
+
+int main(void) {
+  bool passed = true;
+  for (uint8_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i += 1) {
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+      exit(runCase(&cases[i]) ? 0 : 1);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    passed = passed && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+  return passed ? 0 : 1;
+}
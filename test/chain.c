@@ -0,0 +1,43 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include "host.h"
+#include "matrix.h"
+
+/*
+  Sets every channel of a row to a different value and prints the chain
+  length, the values by channel and the bytes of the row in the order
+  shiftRow sends them, for test/chain.py. It is built once per chain length.
+*/
+
+extern volatile uint8_t gsData[ROWS][24 * TLC5940_COUNT];
+
+int main(void) {
+  printf("%u\n", TLC5940_COUNT);
+  for (uint16_t channel = 0; channel < CHANNELS; channel += 1) {
+    /* odd factors give distinct values that use all 12 bits */
+    uint16_t value = (channel * 0x9E3 + 0x5A5) & 0xFFF;
+    setMatrixData(0, channel, value);
+    printf("%s%03x", channel ? " " : "", value);
+  }
+  printf("\n");
+  for (uint16_t i = 0; i < sizeof(gsData[0]); i += 1) {
+    printf("%s%02x", i ? " " : "", gsData[0][i]);
+  }
+  printf("\n");
+  return 0;
+}
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+#
+#   Copyright 2012 Daniel A. Spilker
+#
+#   Licensed under the Apache License, Version 2.0 (the "License");
+#   you may not use this file except in compliance with the License.
+#   You may obtain a copy of the License at
+#
+#       http://www.apache.org/licenses/LICENSE-2.0
+#
+#   Unless required by applicable law or agreed to in writing, software
+#   distributed under the License is distributed on an "AS IS" BASIS,
+#   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#   See the License for the specific language governing permissions and
+#   limitations under the License.
+#
+
+"""Checks the bit order of the grayscale data for chained TLC5940s.
+
+Usage: chain.py HARNESS...
+
+Each HARNESS is test/chain.c built for one chain length. Its output, the
+values set by channel and the row as shiftRow sends it, is shifted bit by
+bit through a model of the daisy chain, in the bit order the SPI is set up
+with in src/matrix.c. Every TLC5940 holds a 192 bit register with OUT15 in
+the highest 12 bits, and SOUT of one feeds SIN of the next. The model fails
+unless channel 16 * n + i ends up in OUTi of the n-th TLC5940 after the
+microcontroller, and the status shifted out of each TLC5940 is captured for
+that TLC5940.
+"""
+
+import re
+import subprocess
+import sys
+
+CHIP_BITS = 192
+CHIP_BYTES = CHIP_BITS // 8
+STATUS_BYTES = 3
+SHIFT_LOOP = 'for (uint8_t k = TLC5940_COUNT; k-- > 0;)'
+
+
+def read_matrix(path):
+    with open(path) as source:
+        text = source.read()
+    spcr = re.search(r'^\s*SPCR = (.*);$', text, re.M).group(1)
+    return 'DORD' not in spcr, SHIFT_LOOP in text
+
+
+def status_register(chip):
+    """Returns a status register with LOD and TEF that identify the chip."""
+    lod = (0x1234 * (chip + 1)) & 0xFFFF
+    tef = chip % 2
+    return [(lod | tef << 16) >> bit & 1 for bit in range(CHIP_BITS)], lod, tef
+
+
+def shift(data, count, msb_first):
+    """Shifts the bytes into the chain and returns the registers and the
+    bytes that came out of the last TLC5940."""
+    registers = [status_register(chip)[0] for chip in range(count)]
+    received = []
+    value = 0
+    for index in range(len(data) * 8):
+        byte = data[index // 8]
+        bit = byte >> (7 - index % 8) & 1 if msb_first else byte >> (index % 8) & 1
+        for register in registers:
+            carry = register[CHIP_BITS - 1]
+            register[1:] = register[:-1]
+            register[0] = bit
+            bit = carry
+        value = value << 1 | bit if msb_first else value | bit << (index % 8)
+        if index % 8 == 7:
+            received.append(value)
+            value = 0
+    return registers, received
+
+
+def check(output, msb_first):
+    lines = output.split('\n')
+    count = int(lines[0])
+    values = [int(text, 16) for text in lines[1].split()]
+    data = [int(text, 16) for text in lines[2].split()]
+    errors = []
+    if len(values) != 16 * count or len(data) != CHIP_BYTES * count:
+        return count, ['%d values and %d bytes' % (len(values), len(data))]
+
+    registers, received = shift(data, count, msb_first)
+    for chip, register in enumerate(registers):
+        for output_index in range(16):
+            bits = register[12 * output_index:12 * output_index + 12]
+            value = sum(bit << position for position, bit in enumerate(bits))
+            expected = values[16 * chip + output_index]
+            if value != expected:
+                errors.append('TLC5940 %d OUT%d is %03x instead of %03x' % (chip, output_index, value, expected))
+
+    # shiftRow captures the last bytes of each block as the status of chip k
+    for block in range(count):
+        chip = count - 1 - block
+        status = received[CHIP_BYTES * (block + 1) - STATUS_BYTES:CHIP_BYTES * (block + 1)]
+        _, lod, tef = status_register(chip)
+        if status[0] & 1 != tef or (status[1] << 8 | status[2]) != lod:
+            errors.append('status of TLC5940 %d is captured from another one' % chip)
+    return count, errors
+
+
+def main():
+    msb_first, known_loop = read_matrix('src/matrix.c')
+    failed = not known_loop
+    if not known_loop:
+        print('shiftRow no longer sends the TLC5940s with %s' % SHIFT_LOOP)
+    for harness in sys.argv[1:]:
+        output = subprocess.run([harness], stdout=subprocess.PIPE, universal_newlines=True, check=True).stdout
+        count, errors = check(output, msb_first)
+        print('%d TLC5940s: %d channels, %s' % (count, 16 * count, 'ok' if not errors else '%d errors' % len(errors)))
+        for error in errors:
+            print('  ' + error)
+        failed = failed or bool(errors)
+    if failed:
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
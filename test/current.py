@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+#
+#   Copyright 2012 Daniel A. Spilker
+#
+#   Licensed under the Apache License, Version 2.0 (the "License");
+#   you may not use this file except in compliance with the License.
+#   You may obtain a copy of the License at
+#
+#       http://www.apache.org/licenses/LICENSE-2.0
+#
+#   Unless required by applicable law or agreed to in writing, software
+#   distributed under the License is distributed on an "AS IS" BASIS,
+#   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#   See the License for the specific language governing permissions and
+#   limitations under the License.
+#
+
+"""Projects the supply current of the clock from the duty cycle of the MCU.
+
+Usage: current.py [CLOCK [OUTPUT_MA [LIT]]]
+
+For each operating state, the model adds up how long the MCU runs, idles and
+sleeps per second, from the wake sources and the work the firmware does per
+wake, and weighs that with typical currents at 5 V from the ATmega88PA,
+TLC5940 and DS1307 data sheets. The LED current is reported separately for
+LIT outputs at full brightness with OUTPUT_MA per output, as set by IREF on
+the board, and the default number of rows.
+
+The currents are typical values, and the cycles per wake are estimates, so
+the results are projections to compare the states with each other. The
+model fails if blanking does not save current over showing a black frame,
+or power-save does not save current over idle sleep.
+"""
+
+import re
+import sys
+
+# ATmega88PA at 8 MHz and 5 V.
+ACTIVE_MA = 4.2
+IDLE_MA = 1.1
+# Timer0 and the SPI in idle mode, as a share of the idle current.
+TIMER0_SHARE = 0.028
+SPI_SHARE = 0.123
+# Power-save without Timer2, with the watchdog and the brown-out detector.
+SLEEP_MA = 0.001 + 0.006 + 0.020
+# Driving GSCLK on CLKO into about 10 pF.
+CLKO_MA = 10e-12 * 5 * 8e6 * 1000
+# TLC5940 with BLANK high, and the extra current of GSCLK and SCLK.
+TLC5940_MA = 3.0
+TLC5940_CLOCKED_MA = 1.0
+# DS1307 on VCC, idle and during a transfer.
+DS1307_MA = 0.2
+DS1307_ACTIVE_MA = 1.5
+
+TICKS_PER_SECOND = 100
+# TIMER1_COMPA_vect without a pending read or a DCF77 signal.
+TICK_CLOCKS = 400
+# One pass of handleUart, handleSync and handleWatchdog with nothing to do.
+WAKE_CLOCKS = 300
+# handleSchedule up to flushLog, without a redraw.
+PASS_CLOCKS = 3000
+# PCINT2_vect with secondCallback and the oscillator calibration.
+SECOND_CLOCKS = 600
+# The address, the register pointer and the date and time, 9 bits each.
+RTC_READ_BITS = 9 * (1 + 1 + 1 + 8)
+TWI_BYTE_CLOCKS = 120
+
+
+def read_constants():
+    values = {}
+    for path, names in (('src/main.c', ('TRANSITION_DELAY', 'HOST_TIMEOUT')),
+                        ('src/matrix.c', ('BLANK_CLOCKS',)),
+                        ('src/matrix.h', ('ROWS',)),
+                        ('src/rtc.h', ('TWI_BITRATE',))):
+        with open(path) as source:
+            text = source.read()
+        for name in names:
+            values[name] = int(re.search(r'^#define %s\s+(\d+)$' % name, text, re.M).group(1))
+    return values
+
+
+def mix(clock, active_clocks, idle_seconds):
+    """Returns the active, idle and sleep shares of a second."""
+    active = active_clocks / clock
+    idle = min(idle_seconds, 1 - active)
+    return active, idle, 1 - active - idle
+
+
+def mcu_ma(shares, idle_ma):
+    active, idle, sleep = shares
+    return active * ACTIVE_MA + idle * idle_ma + sleep * SLEEP_MA
+
+
+def main():
+    clock = int(sys.argv[1]) if len(sys.argv) > 1 else 8000000
+    output_ma = float(sys.argv[2]) if len(sys.argv) > 2 else 20.0
+    lit = int(sys.argv[3]) if len(sys.argv) > 3 else 20
+    constants = read_constants()
+    passes = TICKS_PER_SECOND / constants['TRANSITION_DELAY']
+    rtc_seconds = RTC_READ_BITS / constants['TWI_BITRATE']
+
+    states = []
+
+    # The main loop waits with _delay_ms, so the MCU never sleeps. A black
+    # frame, the only way to turn the matrix off before blanking, costs the
+    # same without the LEDs.
+    shares = (1.0, 0.0, 0.0)
+    logic = TLC5940_MA + TLC5940_CLOCKED_MA + DS1307_MA + CLKO_MA
+    states.append(('display', shares, mcu_ma(shares, IDLE_MA), logic))
+    states.append(('black frame', shares, mcu_ma(shares, IDLE_MA), logic))
+
+    # Idle sleep between the Timer1 ticks while a host is connected, with
+    # Timer0 and the SPI powered down. CLKO and so GSCLK keep running.
+    wakes = TICKS_PER_SECOND
+    active_clocks = wakes * (TICK_CLOCKS + WAKE_CLOCKS) + passes * PASS_CLOCKS + SECOND_CLOCKS
+    shares = mix(clock, active_clocks, 1.0)
+    idle_ma = IDLE_MA * (1 - TIMER0_SHARE - SPI_SHARE)
+    logic = TLC5940_MA + DS1307_MA + CLKO_MA
+    states.append(('blanked, host', shares, mcu_ma(shares, idle_ma), logic))
+
+    # Power-save between the SQW edges, which stops CLKO as well. The loop
+    # runs once per wake, and the schedule every TRANSITION_DELAY seconds.
+    # Once a minute the date is read over TWI in idle sleep.
+    active_clocks = SECOND_CLOCKS + WAKE_CLOCKS + PASS_CLOCKS / constants['TRANSITION_DELAY']
+    active_clocks += (RTC_READ_BITS / 9) * TWI_BYTE_CLOCKS / 60
+    idle_seconds = rtc_seconds / 60
+    shares = mix(clock, active_clocks, idle_seconds)
+    awake = shares[0] + shares[1]
+    logic = TLC5940_MA + DS1307_MA + awake * CLKO_MA + idle_seconds * (DS1307_ACTIVE_MA - DS1307_MA)
+    states.append(('blanked, power-save', shares, mcu_ma(shares, idle_ma), logic))
+
+    print('state                 active     idle    sleep  MCU/mA  logic/mA  total/mA')
+    totals = {}
+    for name, (active, idle, sleep), mcu, logic in states:
+        totals[name] = mcu + logic
+        print('%-20s %6.2f%%  %6.2f%%  %6.2f%%  %6.3f  %8.3f  %8.3f' % (
+            name, active * 100, idle * 100, sleep * 100, mcu, logic, mcu + logic))
+    duty = ((1 << 12) - constants['BLANK_CLOCKS']) / (1 << 12) / constants['ROWS']
+    print('LEDs: %d outputs at %.0f mA, each lit in one of %d rows: %.1f mA' % (
+        lit, output_ma, constants['ROWS'], lit * output_ma * duty))
+    print('A host wake keeps the idle state for %d s after the last byte.' % constants['HOST_TIMEOUT'])
+
+    failed = False
+    if totals['blanked, host'] >= totals['black frame']:
+        print('blanking draws no less than a black frame')
+        failed = True
+    if totals['blanked, power-save'] >= totals['blanked, host']:
+        print('power-save draws no less than idle sleep')
+        failed = True
+    if failed:
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,170 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#define _DEFAULT_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "host.h"
+
+#pragma pack(push, 1)
+#include "effects.h"
+#include "matrix.h"
+#include "phrases.h"
+#pragma pack(pop)
+
+/*
+  Renders the transition from 10:00 to 10:05 with every effect into a PGM
+  image per effect in the given directory, the old frame and then one frame
+  per transition step from top to bottom, and reports the host time of the
+  slowest step. Like handleMatrix, every step first advances the effect, and
+  then blends every cell with blendCell at full brightness. Fails unless the
+  last step of every transition shows the new frame completely, because the
+  cells that are not there yet would only fade in one level per step
+  afterwards, and if a step takes more than STEP_BUDGET cycles.
+
+  effects.c and matrix.c are built with -fsanitize-coverage=trace-pc like
+  for test/replay.c, which counts BLOCK_CYCLES per basic block on the
+  simulated clock of host.c. The budget covers the effect code of a step,
+  which runs in a main loop pass that must fit into the TRANSITION_DELAY of
+  5 ms, together with the gamma lookups and setMatrixData.
+*/
+
+#define SCALE     4
+#define GAP       2
+#define BATCHES   5
+#define REPEATS   400
+#define MAX_STEPS 512
+
+#define BLOCK_CYCLES 8
+#define STEP_BUDGET  8000
+
+static uint16_t oldFrame[PHRASE_ROWS];
+static uint16_t newFrame[PHRASE_ROWS];
+static uint8_t pixels[MAX_STEPS][ROWS][COLUMNS];
+
+static bool isLit(const uint16_t frame[], uint8_t row, uint8_t column) {
+  return row < PHRASE_ROWS && frame[row] & (1 << (COLUMNS - 1 - column));
+}
+
+static void renderFrame(uint8_t cells[ROWS][COLUMNS], const uint16_t frame[]) {
+  for (uint8_t row = 0; row < ROWS; row += 1) {
+    for (uint8_t column = 0; column < COLUMNS; column += 1) {
+      cells[row][column] = isLit(frame, row, column) ? 0xFF : 0;
+    }
+  }
+}
+
+static void renderStep(uint8_t cells[ROWS][COLUMNS], uint8_t previous[ROWS][COLUMNS]) {
+  for (uint8_t row = 0; row < ROWS; row += 1) {
+    for (uint8_t column = 0; column < COLUMNS; column += 1) {
+      bool lit = isLit(newFrame, row, column);
+      bool changing = lit != isLit(oldFrame, row, column);
+      uint8_t phase = changing ? getEffectPhase(row, column) : 0;
+      cells[row][column] = blendCell(previous[row][column], lit ? 0xFF : 0, 0xFF, changing, phase);
+    }
+  }
+}
+
+static double getSeconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void writeImage(const char* directory, uint8_t effect, uint16_t steps) {
+  char name[256];
+  snprintf(name, sizeof(name), "%s/effect-%u.pgm", directory, effect);
+  FILE* file = fopen(name, "wb");
+  if (!file) {
+    perror(name);
+    return;
+  }
+  uint16_t width = COLUMNS * SCALE;
+  uint16_t height = steps * (ROWS * SCALE + GAP);
+  fprintf(file, "P5\n%u %u\n255\n", width, height);
+  for (uint16_t step = 0; step < steps; step += 1) {
+    for (uint16_t y = 0; y < ROWS * SCALE + GAP; y += 1) {
+      for (uint16_t x = 0; x < width; x += 1) {
+        fputc(y < ROWS * SCALE ? pixels[step][y / SCALE][x / SCALE] : 0x40, file);
+      }
+    }
+  }
+  fclose(file);
+}
+
+int main(int argc, char** argv) {
+  const char* directory = argc > 1 ? argv[1] : ".";
+  bool passed = true;
+
+  planPhrase(10, 0, LAYOUT_STANDARD, oldFrame);
+  planPhrase(10, 5, LAYOUT_STANDARD, newFrame);
+  hostBlockCycles = BLOCK_CYCLES;
+  printf("effect steps  worst ns/step  worst cycles/step\n");
+  for (uint8_t effect = 1; effect < EFFECTS; effect += 1) {
+    uint16_t steps = 1;
+    double worst = 0;
+    uint64_t worstCycles = 0;
+    renderFrame(pixels[0], oldFrame);
+    startEffect(effect);
+    for (;;) {
+      uint64_t cycles = hostCycles;
+      advanceEffect();
+      if (!isEffectRunning() || steps == MAX_STEPS) {
+        break;
+      }
+      renderStep(pixels[steps], pixels[steps - 1]);
+      cycles = hostCycles - cycles;
+      if (cycles > worstCycles) {
+        worstCycles = cycles;
+      }
+      /* the fastest batch is the one least disturbed by the host */
+      double elapsed = 1;
+      for (uint8_t batch = 0; batch < BATCHES; batch += 1) {
+        double start = getSeconds();
+        for (uint16_t i = 0; i < REPEATS; i += 1) {
+          renderStep(pixels[steps], pixels[steps - 1]);
+        }
+        double batchElapsed = (getSeconds() - start) / REPEATS;
+        if (batchElapsed < elapsed) {
+          elapsed = batchElapsed;
+        }
+      }
+      if (elapsed > worst) {
+        worst = elapsed;
+      }
+      steps += 1;
+    }
+    writeImage(directory, effect, steps);
+    printf("%6u %5u  %13.0f  %17lu\n", effect, steps - 1, worst * 1e9, (unsigned long) worstCycles);
+    if (worstCycles > STEP_BUDGET) {
+      printf("effect %u: a step takes more than %u cycles\n", effect, STEP_BUDGET);
+      passed = false;
+    }
+
+    for (uint8_t row = 0; row < ROWS; row += 1) {
+      for (uint8_t column = 0; column < COLUMNS; column += 1) {
+        uint8_t last = pixels[steps - 1][row][column];
+        if (isLit(newFrame, row, column) ? last < 0xFE : last != 0) {
+          printf("effect %u: cell %u/%u does not show the new frame after the last step\n", effect, row, column);
+          passed = false;
+        }
+      }
+    }
+  }
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,37 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef __HOST_AVR_EEPROM_H_
+#define __HOST_AVR_EEPROM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The EEPROM is emulated by host.c, addresses are offsets into hostEeprom. */
+
+#define EEMEM
+
+#define eeprom_is_ready() 1
+#define eeprom_busy_wait()
+
+uint8_t eeprom_read_byte(const uint8_t* address);
+
+void eeprom_update_byte(uint8_t* address, uint8_t value);
+
+void eeprom_read_block(void* destination, const void* source, size_t size);
+
+void eeprom_update_block(const void* source, void* destination, size_t size);
+
+#endif
@@ -0,0 +1,38 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef __HOST_AVR_INTERRUPT_H_
+#define __HOST_AVR_INTERRUPT_H_
+
+#include <stdint.h>
+
+/*
+  Interrupt handlers become plain functions that a test can call. The global
+  interrupt flag is emulated by host.c, which defers interrupts raised while
+  it is cleared.
+*/
+
+#define ISR(vector, ...) void vector(void); void vector(void)
+
+#define sei() hostEnableInterrupts()
+#define cli() hostDisableInterrupts()
+
+void hostEnableInterrupts(void);
+
+uint8_t hostDisableInterrupts(void);
+
+void hostRestoreInterrupts(uint8_t enabled);
+
+#endif
@@ -0,0 +1,150 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef __HOST_AVR_IO_H_
+#define __HOST_AVR_IO_H_
+
+#include <stdint.h>
+
+/*
+  The ATmega88PA registers used by the firmware, as plain variables for the
+  host build. host.c defines them by setting HOST_REGISTER to nothing.
+*/
+#ifndef HOST_REGISTER
+#define HOST_REGISTER extern
+#endif
+
+HOST_REGISTER volatile uint8_t PINB, DDRB, PORTB, PINC, DDRC, PORTC, PIND, DDRD, PORTD;
+HOST_REGISTER volatile uint8_t SPCR, SPSR, SPDR;
+HOST_REGISTER volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, TIMSK0, TIFR0;
+HOST_REGISTER volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+HOST_REGISTER volatile uint16_t TCNT1, OCR1A, OCR1B;
+HOST_REGISTER volatile uint8_t OCR1AH, OCR1AL;
+HOST_REGISTER volatile uint8_t TWBR, TWSR, TWDR, TWCR;
+HOST_REGISTER volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UDR0;
+HOST_REGISTER volatile uint16_t UBRR0;
+HOST_REGISTER volatile uint8_t UBRR0H, UBRR0L;
+HOST_REGISTER volatile uint8_t EICRA, EIMSK, EIFR, PCICR, PCIFR, PCMSK2;
+HOST_REGISTER volatile uint8_t MCUSR, MCUCR, WDTCSR, PRR, SMCR, CLKPR, OSCCAL, GPIOR0;
+HOST_REGISTER volatile uint8_t EECR, SPMCSR;
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+#define SPI2X 0
+#define MSTR 4
+#define SPE 6
+#define SPIF 7
+
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM01 1
+#define OCIE0A 1
+#define OCF0A 1
+
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define OCIE1A 1
+#define OCIE1B 2
+#define OCF1A 1
+
+#define TWIE 0
+#define TWEN 2
+#define TWSTO 4
+#define TWSTA 5
+#define TWEA 6
+#define TWINT 7
+
+#define U2X0 1
+#define DOR0 3
+#define FE0 4
+#define UDRE0 5
+#define TXC0 6
+#define RXC0 7
+#define UCSZ00 1
+#define UCSZ01 2
+#define TXEN0 3
+#define RXEN0 4
+#define UDRIE0 5
+#define RXCIE0 7
+
+#define ISC00 0
+#define ISC01 1
+#define INT0 0
+#define INTF0 0
+#define PCIE2 2
+#define PCIF2 2
+#define PCINT16 0
+#define PCINT18 2
+
+#define PORF 0
+#define EXTRF 1
+#define BORF 2
+#define WDRF 3
+#define WDE 3
+#define WDCE 4
+#define IVCE 0
+#define IVSEL 1
+
+#define PRADC 0
+#define PRUSART0 1
+#define PRSPI 2
+#define PRTIM1 3
+#define PRTIM0 5
+#define PRTIM2 6
+#define PRTWI 7
+
+#define EERE 0
+#define EEPE 1
+#define SELFPRGEN 0
+#define RWWSRE 4
+#define RWWSB 6
+
+#define RAMSTART 0x100
+#define RAMEND 0x4FF
+#define E2END 0x1FF
+#define FLASHEND 0x1FFF
+#define SPM_PAGESIZE 64
+
+#define _BV(bit) (1 << (bit))
+#define bit_is_set(sfr, bit) ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+#define loop_until_bit_is_set(sfr, bit) do { } while (bit_is_clear(sfr, bit))
+#define loop_until_bit_is_clear(sfr, bit) do { } while (bit_is_set(sfr, bit))
+
+#endif
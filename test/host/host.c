@@ -0,0 +1,176 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#define _DEFAULT_SOURCE
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#define HOST_REGISTER
+#include <avr/eeprom.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include "host.h"
+
+uint8_t hostEeprom[E2END + 1] = { [0 ... E2END] = 0xFF };
+uint16_t hostEepromReads;
+
+uint64_t hostCycles;
+uint8_t hostBlockCycles;
+
+static volatile sig_atomic_t interruptsEnabled = 1;
+static volatile sig_atomic_t interruptPending = 0;
+static void (*interruptHandler)(void);
+static uint64_t (*clockHandler)(void);
+static uint64_t clockEvent = UINT64_MAX;
+
+uint8_t eeprom_read_byte(const uint8_t* address) {
+  return hostEeprom[(uintptr_t) address];
+}
+
+void eeprom_update_byte(uint8_t* address, uint8_t value) {
+  hostEeprom[(uintptr_t) address] = value;
+}
+
+void eeprom_read_block(void* destination, const void* source, size_t size) {
+  memcpy(destination, &hostEeprom[(uintptr_t) source], size);
+  hostEepromReads += 1;
+}
+
+void eeprom_update_block(const void* source, void* destination, size_t size) {
+  memcpy(&hostEeprom[(uintptr_t) destination], source, size);
+}
+
+static void raiseInterrupt(int signal) {
+  if (!interruptsEnabled) {
+    interruptPending = 1;
+    return;
+  }
+  interruptsEnabled = 0;
+  interruptHandler();
+  interruptsEnabled = 1;
+}
+
+/*
+  The handler is also called from the code it calls itself, like the ISRs,
+  so that the registers keep up with the clock while they run.
+*/
+static void runClock(void) {
+  if (clockHandler) {
+    clockEvent = clockHandler();
+  }
+}
+
+/*
+  Called on every basic block of the code built with
+  -fsanitize-coverage=trace-pc.
+*/
+void __sanitizer_cov_trace_pc(void) {
+  hostCycles += hostBlockCycles;
+  runClock();
+}
+
+/*
+  A signal that arrives after the pending interrupt has been handled, but
+  before the flag is set, is pending again and handled by the next pass.
+  With the clock, an interrupt flagged meanwhile is taken right away.
+*/
+void hostEnableInterrupts(void) {
+  for (;;) {
+    while (interruptPending) {
+      interruptPending = 0;
+      interruptHandler();
+    }
+    interruptsEnabled = 1;
+    if (!interruptPending) {
+      runClock();
+      return;
+    }
+    interruptsEnabled = 0;
+  }
+}
+
+uint8_t hostDisableInterrupts(void) {
+  uint8_t enabled = interruptsEnabled;
+  interruptsEnabled = 0;
+  return enabled;
+}
+
+void hostRestoreInterrupts(uint8_t enabled) {
+  if (enabled) {
+    hostEnableInterrupts();
+  }
+}
+
+void hostStartInterrupts(uint32_t period, void (*handler)(void)) {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = raiseInterrupt;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  interruptHandler = handler;
+  sigaction(SIGALRM, &action, 0);
+
+  struct timeval interval = { period / 1000000, period % 1000000 };
+  struct itimerval timer = { interval, interval };
+  setitimer(ITIMER_REAL, &timer, 0);
+}
+
+void hostStopInterrupts(void) {
+  struct itimerval timer = { { 0, 0 }, { 0, 0 } };
+  setitimer(ITIMER_REAL, &timer, 0);
+  interruptPending = 0;
+}
+
+void hostStartClock(uint64_t (*handler)(void)) {
+  clockHandler = handler;
+  clockEvent = 0;
+  runClock();
+}
+
+/*
+  Like the loop of _delay_us, the delay only counts the cycles of the code
+  that waits, so interrupts make it longer.
+*/
+void hostDelay(uint32_t cycles) {
+  while (clockHandler && cycles) {
+    uint64_t step = clockEvent > hostCycles ? clockEvent - hostCycles : 0;
+    step = step < cycles ? step : cycles;
+    hostCycles += step;
+    cycles -= step;
+    runClock();
+  }
+}
+
+void hostSleep(void) {
+  if (clockHandler && clockEvent > hostCycles) {
+    hostCycles = clockEvent;
+  }
+  runClock();
+}
+
+void hostAbort(const char* message) {
+  write(STDERR_FILENO, message, strlen(message));
+  _exit(1);
+}
+
+uint64_t hostNanoseconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
@@ -0,0 +1,59 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef __HOST_H_
+#define __HOST_H_
+
+#include <stdint.h>
+#include <avr/io.h>
+
+/*
+  State of the emulated microcontroller. The EEPROM starts erased, and every
+  block read is counted, so tests can tell when a module touches it.
+*/
+extern uint8_t hostEeprom[E2END + 1];
+extern uint16_t hostEepromReads;
+
+/*
+  Raises an interrupt every period microseconds by calling handler from a
+  signal, which then plays the part of the hardware. While the firmware has
+  interrupts disabled, one raised interrupt is kept pending, like an AVR
+  interrupt flag.
+*/
+void hostStartInterrupts(uint32_t period, void (*handler)(void));
+
+void hostStopInterrupts(void);
+
+/*
+  Runs the firmware on a simulated clock of hostCycles CPU cycles instead.
+  Code built with -fsanitize-coverage=trace-pc advances it by hostBlockCycles
+  per basic block, the delays by their length, and sleep to the next event.
+  handler plays the part of the hardware: it is called on every basic block
+  and whenever the clock reaches the cycle it returned last, updates the
+  registers, calls the ISRs while interrupts are enabled, and returns the
+  cycle of its next event.
+*/
+extern uint64_t hostCycles;
+extern uint8_t hostBlockCycles;
+
+void hostStartClock(uint64_t (*handler)(void));
+
+/* Reports a failure and exits, also from the interrupt handler. */
+void hostAbort(const char* message);
+
+/* Returns a monotonic time in nanoseconds, for benchmarks. */
+uint64_t hostNanoseconds(void);
+
+#endif
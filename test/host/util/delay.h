@@ -0,0 +1,27 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef __HOST_UTIL_DELAY_H_
+#define __HOST_UTIL_DELAY_H_
+
+#include <stdint.h>
+
+/* The delays only take time on the simulated clock of host.c. */
+#define _delay_ms(ms) hostDelay((ms) * (F_CPU / 1000UL))
+#define _delay_us(us) hostDelay((us) * (F_CPU / 1000000UL))
+
+void hostDelay(uint32_t cycles);
+
+#endif
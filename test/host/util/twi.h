@@ -0,0 +1,34 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef __HOST_UTIL_TWI_H_
+#define __HOST_UTIL_TWI_H_
+
+#define TW_START        0x08
+#define TW_REP_START    0x10
+#define TW_MT_SLA_ACK   0x18
+#define TW_MT_DATA_ACK  0x28
+#define TW_MR_SLA_ACK   0x40
+#define TW_MR_DATA_ACK  0x50
+#define TW_MR_DATA_NACK 0x58
+#define TW_NO_INFO      0xF8
+
+#define TW_STATUS_MASK  0xF8
+#define TW_STATUS       (TWSR & TW_STATUS_MASK)
+
+#define TW_WRITE        0
+#define TW_READ         1
+
+#endif
@@ -0,0 +1,195 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "host.h"
+
+/*
+  The firmware structs are packed like on the AVR, but the C library headers
+  above must keep the host layout, so only the firmware headers are packed.
+*/
+#pragma pack(push, 1)
+#include "effects.h"
+#include "matrix.h"
+#include "phrases.h"
+#include "schedule.h"
+#include "time.h"
+#pragma pack(pop)
+
+/*
+  Replays the pure logic of the firmware and prints the results, which make
+  test compares with golden/logic.txt. The harness is built with the default
+  matrix size, so the output does not depend on the configuration.
+*/
+
+#define NOT_REACHED 0xFFFF
+
+extern volatile uint8_t gsData[ROWS][24 * TLC5940_COUNT];
+
+static void printPhrases(void) {
+  for (uint8_t layout = 0; layout < LAYOUTS; layout += 1) {
+    uint16_t last[PHRASE_ROWS] = { 0 };
+    for (uint8_t hours = 0; hours < 12; hours += 1) {
+      for (uint8_t minutes = 0; minutes < 60; minutes += 1) {
+        uint16_t frame[PHRASE_ROWS];
+        planPhrase(hours, minutes, layout, frame);
+        if (!memcmp(frame, last, sizeof(frame))) {
+          continue;
+        }
+        memcpy(last, frame, sizeof(frame));
+        printf("phrase %u %2u:%02u", layout, hours, minutes);
+        for (uint8_t i = 0; i < PHRASE_ROWS; i += 1) {
+          printf(" %03x", frame[i]);
+        }
+        printf("\n");
+      }
+    }
+  }
+}
+
+static void printSteps(const char* name, uint16_t steps[ROWS][COLUMNS]) {
+  for (uint8_t row = 0; row < ROWS; row += 1) {
+    printf("  %-5s", name);
+    for (uint8_t column = 0; column < COLUMNS; column += 1) {
+      if (steps[row][column] == NOT_REACHED) {
+        printf("   -");
+      } else {
+        printf(" %3u", steps[row][column]);
+      }
+    }
+    printf("\n");
+  }
+}
+
+/*
+  For each cell, prints the transition step at which it starts to change and
+  the one at which it shows the new frame completely.
+*/
+static void printEffects(void) {
+  for (uint8_t effect = 0; effect <= EFFECTS; effect += 1) {
+    uint16_t first[ROWS][COLUMNS];
+    uint16_t full[ROWS][COLUMNS];
+    uint16_t step = 0;
+    memset(first, 0xFF, sizeof(first));
+    memset(full, 0xFF, sizeof(full));
+
+    startEffect(effect);
+    while (isEffectRunning()) {
+      for (uint8_t row = 0; row < ROWS; row += 1) {
+        for (uint8_t column = 0; column < COLUMNS; column += 1) {
+          uint8_t phase = getEffectPhase(row, column);
+          if (phase && first[row][column] == NOT_REACHED) {
+            first[row][column] = step;
+          }
+          if (phase == 0xFF && full[row][column] == NOT_REACHED) {
+            full[row][column] = step;
+          }
+        }
+      }
+      advanceEffect();
+      step += 1;
+    }
+    printf("effect %u steps %u\n", effect, step);
+    if (step) {
+      printSteps("first", first);
+      printSteps("full", full);
+    }
+  }
+}
+
+static void printRule(uint8_t dayOfWeek, uint16_t minute, const rule_t* rule) {
+  printf("schedule %u %02u:%02u", dayOfWeek, minute / 60, minute % 60);
+  if (rule) {
+    printf(" %04u-%04u brightness %u effect %u flags %02x\n",
+           rule->start, rule->end, rule->brightness, rule->effect, rule->flags);
+  } else {
+    printf(" none\n");
+  }
+}
+
+/*
+  Walks through a week minute by minute and prints every change of the active
+  rule, and how often each day the rules were read from the EEPROM. Day 0 is
+  an unknown day of the week, on which the days of a rule are ignored.
+*/
+static void printSchedule(void) {
+  const rule_t rules[] = {
+    { 0x1F, 1320, 390, 10, EFFECT_KEEP, 0 },
+    { 0x60, 1380, 480, 5, EFFECT_KEEP, _BV(RULE_BLANK) },
+    { 0x7F, 720, 780, 0, EFFECT_RAIN, _BV(RULE_FLASH) | _BV(RULE_KEEP_BRIGHTNESS) },
+    { 0x04, 600, 600, 20, EFFECT_WIPE, 0 },
+  };
+  for (uint8_t i = 0; i < sizeof(rules) / sizeof(rules[0]); i += 1) {
+    writeRule(i, &rules[i]);
+  }
+
+  rule_t last = { 0 };
+  bool active = false;
+  for (uint8_t dayOfWeek = 0; dayOfWeek <= 7; dayOfWeek += 1) {
+    uint16_t reads = hostEepromReads;
+    for (uint16_t minute = 0; minute < 24 * 60; minute += 1) {
+      time_t time = { 0, minute % 60, minute / 60, 1, 1, 0, dayOfWeek };
+      updateSchedule(&time);
+      const rule_t* rule = getActiveRule();
+      if (rule ? !active || memcmp(rule, &last, sizeof(rule_t)) : active) {
+        printRule(dayOfWeek, minute, rule);
+        active = rule;
+        if (rule) {
+          last = *rule;
+        }
+      }
+    }
+    printf("schedule %u evaluations %u\n", dayOfWeek, (hostEepromReads - reads) / RULES);
+  }
+}
+
+static void printRow(const char* name, uint8_t row) {
+  printf("matrix %-10s", name);
+  for (uint8_t i = 0; i < sizeof(gsData[row]); i += 1) {
+    printf(" %02x", gsData[row][i]);
+  }
+  printf("\n");
+}
+
+/*
+  Sets each channel alone to full scale, then all channels to distinct
+  values, and prints the bytes in the order they are shifted out.
+*/
+static void printMatrixData(void) {
+  char name[16];
+  for (uint8_t channel = 0; channel < CHANNELS; channel += 1) {
+    for (uint8_t i = 0; i < CHANNELS; i += 1) {
+      setMatrixData(0, i, i == channel ? 0xFFF : 0);
+    }
+    snprintf(name, sizeof(name), "channel %u", channel);
+    printRow(name, 0);
+  }
+  for (uint8_t channel = 0; channel < CHANNELS; channel += 1) {
+    setMatrixData(ROWS - 1, channel, channel * 0x111 & 0xFFF);
+  }
+  printRow("ramp", ROWS - 1);
+  printRow("untouched", 1);
+}
+
+int main(void) {
+  printPhrases();
+  printEffects();
+  printSchedule();
+  printMatrixData();
+  return 0;
+}
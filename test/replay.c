@@ -0,0 +1,1009 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include "dcf77.h"
+#include "host.h"
+#include "matrix.h"
+#include "profile.h"
+#include "settings.h"
+#include "sync.h"
+
+/*
+  Replays a scripted timeline against the whole firmware on the simulated
+  clock of host.c. The firmware is built with -fsanitize-coverage=trace-pc,
+  and every basic block counts as BLOCK_CYCLES, so the ISRs interrupt the
+  main loop wherever it is when they are due, and the profile counters of
+  profile.c measure the durations on Timer1 like on the AVR. The cost of a
+  block is only a rough estimate of the AVR code, the counters serve to
+  compare commits.
+
+  This file plays the hardware: Timer0 and Timer1, the SPI and the TLC5940,
+  the USART at the configured baud rate, a DS1307 on the TWI with its square
+  wave on SQW, and a DCF77 receiver. The script feeds command lines, DCF77
+  signals and RTC faults at given times. The trace, written to the file given
+  first, logs the UART traffic, the RTC writes and, per second, the number
+  and a CRC of the rows whose grayscale data changed at a latch, and dumps
+  the displayed frame where the script says so. make test compares it to
+  test/golden/replay.txt.
+
+  Afterwards the longest durations of the profiles and the longest delay of
+  a row latch are checked against their budgets, and against the baseline in
+  the file given second, which they must not exceed by more than a tenth. So
+  are the cycles from reset until every row shows the words, and until every
+  row shows the data, that it still shows at SETTLED_MS, when the fade-in is
+  over and the time from the RTC has not reached the next minute. The words
+  must already be shown by the first refresh after reset. Power-save sleep is not modelled, so the script uses no blank rules.
+
+  With --chain and a number of nodes, it replays a chain of clocks instead,
+  each in its own process: a sync master, and followers that each receive
+  what the previous node sent. The followers start at other times and
+  second phases. A follower relays the time a minute after it was synced.
+  Every follower must be synced, and its SQW edges must then be within
+  CHAIN_SKEW_MS of those of the master.
+*/
+
+#define BLOCK_CYCLES    8
+#define NEVER           UINT64_MAX
+#define CYCLES_PER_MS   (F_CPU / 1000)
+#define CYCLES_PER_S    F_CPU
+#define MINUTE          (60 * CYCLES_PER_S)
+
+#define GS_DATA_SIZE    (24 * TLC5940_COUNT)
+
+#define DS1307_ADDRESS  0x68
+#define DS1307_CH       0x80
+#define DS1307_SQWE     0x10
+#define DS1307_SIZE     64
+
+#define TWI_IDLE        0
+#define TWI_ADDRESS     1
+#define TWI_WRITE       2
+#define TWI_READ        3
+
+#define TW_MT_SLA_NACK  0x20
+#define TW_MR_SLA_NACK  0x48
+
+#define BASELINE_MARGIN 10
+#define LINE_SIZE       80
+#define UART_BYTES      1024
+#define EDGES           128
+
+#define CHAIN_SECONDS   10
+#define CHAIN_SKEW_MS   10
+
+#define SETTLED_MS      500
+
+#define REPORTS         (PROFILES + 3)
+#define REPORT_LATENCY  PROFILES
+#define REPORT_STARTUP  (PROFILES + 1)
+#define REPORT_SETTLED  (PROFILES + 2)
+
+typedef struct {
+  uint32_t ms;
+  const char* action;
+} step_t;
+
+/* A byte on the UART line, at the end of its stop bit. */
+typedef struct {
+  uint64_t at;
+  uint8_t byte;
+} transfer_t;
+
+/* A falling SQW edge, with the second of the day the RTC advanced to. */
+typedef struct {
+  uint64_t at;
+  uint32_t second;
+} edge_t;
+
+/* What a node of a chain sent, and when its RTC ticked and was first written. */
+typedef struct {
+  uint16_t transfers;
+  transfer_t sent[UART_BYTES];
+  uint8_t edges;
+  edge_t ticks[EDGES];
+  uint64_t writtenAt;
+} node_t;
+
+/*
+  The RTC starts on Friday, 14.6.13 at 07:59:50. The DCF77 signal, given as
+  YYMMDDWhhmm and a number of minutes, sends 09:15 on the same day, which the
+  firmware takes over at the end of its first minute. The RTC faults hit the
+  reads at the start of a minute. Rule 0 dims the display on Saturdays only,
+  so it must take effect once 't' moves the date to Saturday, 15.6.13.
+*/
+static const step_t script[] = {
+  { 500, "frame" },
+  { 9000, "uart v" },
+  { 12000, "frame" },
+  { 15000, "uart b80" },
+  { 16000, "frame" },
+  { 20000, "uart e01" },
+  { 21000, "uart t130614085958" },
+  { 25000, "frame" },
+  { 45000, "dcf77 13061450915 2" },
+  { 82500, "rtc nack 2000" },
+  { 160000, "frame" },
+  { 161000, "uart s0802" },
+  { 162900, "rtc hang 300" },
+  { 165000, "frame" },
+  { 170000, "uart t" },
+  { 171000, "uart l" },
+  { 172000, "uart a00200000000010FF00" },
+  { 173000, "uart t130615120000" },
+  { 174000, "frame" },
+  { 175000, "end" },
+};
+
+static const step_t* steps = script;
+static uint8_t stepCount = sizeof(script) / sizeof(script[0]);
+
+static const char* const reportNames[REPORTS] = {
+  "matrix", "timer1", "twi", "uart", "loop", "latency", "startup", "settled",
+};
+
+/*
+  The budgets in CPU cycles, 0 for none. The row ISR shifts while the row is
+  lit and must leave half of it to the rest, and no latch may be late by a
+  whole row. The RX ISR must keep up with 57600 baud, and a pass of the main
+  loop must fit in one step of a transition. The Timer1 ISR has no budget:
+  at the end of every DCF77 minute it validates and decodes the time, which
+  takes longer than a row, and the next latch comes that much late.
+*/
+static const uint32_t budgets[REPORTS] = { 2048, 0, 0, 1388, 40000, 4096, 0, 0 };
+
+extern volatile uint8_t gsData[ROWS][GS_DATA_SIZE];
+extern uint8_t resetCause;
+
+int firmwareMain(void);
+
+void TIMER1_COMPA_vect(void);
+void TIMER0_COMPA_vect(void);
+void PCINT2_vect(void);
+void USART_RX_vect(void);
+void USART_UDRE_vect(void);
+void TWI_vect(void);
+
+static FILE* trace;
+static const char* baselineFile;
+static bool ended;
+static bool modelling;
+static bool dispatching;
+static uint8_t nextStep;
+static uint64_t stepAt;
+static uint64_t nextEvent;
+static bool udrie;
+static uint64_t windowAt = CYCLES_PER_S;
+
+static uint64_t timer1At = NEVER;
+static uint64_t timer0At = NEVER;
+static uint64_t timer0Compare;
+static uint32_t timer0Config;
+static bool timer0Pending;
+
+static uint8_t latchRow;
+static uint8_t shifted[GS_DATA_SIZE];
+static uint8_t latched[ROWS][GS_DATA_SIZE];
+static uint64_t litSince[ROWS];
+static uint64_t settledSince[ROWS];
+static uint64_t firstRefreshEnd = NEVER;
+static uint16_t changes;
+static uint32_t crc;
+static uint32_t maxima[REPORTS];
+
+static transfer_t rxBytes[UART_BYTES];
+static uint16_t rxCount;
+static uint16_t rxNext;
+static uint64_t rxAt = NEVER;
+static uint8_t rxByte;
+static bool rxPending;
+static uint16_t overruns;
+static uint64_t txFree;
+static uint64_t txEnd;
+static char txLine[LINE_SIZE];
+static uint8_t txLength;
+
+static uint8_t rtc[DS1307_SIZE];
+static uint64_t secondAt;
+static uint64_t rtcAt;
+static bool sqw;
+static bool sqwPin;
+static bool pcintPending;
+static uint64_t nackUntil;
+static uint64_t hangUntil;
+
+static uint8_t twiState;
+static uint8_t twiStatus;
+static uint8_t twiPointer;
+static uint8_t twiFirst;
+static bool twiPointerSet;
+static bool twiWritten;
+static uint64_t twiAt = NEVER;
+
+static uint8_t dcf77Bits[59];
+static uint64_t dcf77Start;
+static uint64_t dcf77End;
+static uint64_t dcf77At = NEVER;
+static bool dcf77Level;
+static uint16_t dcf77Minute = UINT16_MAX;
+static uint8_t dcf77Time[6];
+
+static int chainOutput = -1;
+static node_t node;
+
+static void writeTrace(const char* format, ...) __attribute__ ((format (printf, 1, 2)));
+
+static void writeTrace(const char* format, ...) {
+  va_list arguments;
+  if (!trace) {
+    return;
+  }
+  fprintf(trace, "%9.3f ", (double) hostCycles / CYCLES_PER_S);
+  va_start(arguments, format);
+  vfprintf(trace, format, arguments);
+  va_end(arguments);
+  fputc('\n', trace);
+}
+
+static uint8_t toBcd(uint8_t value) {
+  return (value / 10) << 4 | value % 10;
+}
+
+static uint8_t fromBcd(uint8_t value) {
+  return (value >> 4) * 10 + (value & 0x0F);
+}
+
+static uint8_t getDaysOfMonth(uint8_t month, uint8_t year) {
+  static const uint8_t days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  return month == 2 && year % 4 == 0 ? 29 : days[(month - 1) % 12];
+}
+
+/*
+  Advances a time given as seconds, minutes, hours, day of the week, day,
+  month and year by one second, like the counters of the DS1307.
+*/
+static void advanceTime(uint8_t time[7]) {
+  static const uint8_t limits[] = { 60, 60, 24 };
+  for (uint8_t i = 0; i < 3; i += 1) {
+    time[i] += 1;
+    if (time[i] < limits[i]) {
+      return;
+    }
+    time[i] = 0;
+  }
+  time[3] = time[3] % 7 + 1;
+  time[4] += 1;
+  if (time[4] <= getDaysOfMonth(time[5], time[6])) {
+    return;
+  }
+  time[4] = 1;
+  time[5] += 1;
+  if (time[5] <= 12) {
+    return;
+  }
+  time[5] = 1;
+  time[6] = (time[6] + 1) % 100;
+}
+
+/* The SQW output falls when the seconds advance and rises half way. */
+static void tickRtc(void) {
+  if (hostCycles >= secondAt + CYCLES_PER_S) {
+    secondAt += CYCLES_PER_S;
+    if (!(rtc[0] & DS1307_CH)) {
+      uint8_t time[7];
+      for (uint8_t i = 0; i < 7; i += 1) {
+	time[i] = i == 3 ? rtc[i] : fromBcd(rtc[i]);
+      }
+      advanceTime(time);
+      for (uint8_t i = 0; i < 7; i += 1) {
+	rtc[i] = i == 3 ? time[i] : toBcd(time[i]);
+      }
+      if (node.edges < EDGES) {
+	node.ticks[node.edges++] = (edge_t) { secondAt, (time[2] * 60UL + time[1]) * 60 + time[0] };
+      }
+    }
+  }
+  bool running = !(rtc[0] & DS1307_CH) && rtc[7] & DS1307_SQWE;
+  sqw = running && hostCycles >= secondAt + CYCLES_PER_S / 2;
+  rtcAt = hostCycles < secondAt + CYCLES_PER_S / 2 ? secondAt + CYCLES_PER_S / 2 : secondAt + CYCLES_PER_S;
+}
+
+static void traceRtcWrite(void) {
+  if (twiWritten && twiFirst == 0) {
+    node.writtenAt = node.writtenAt ? node.writtenAt : hostCycles;
+    writeTrace("rtc < %02X-%02X-%02X %X %02X:%02X:%02X", rtc[6], rtc[5], rtc[4], rtc[3], rtc[2], rtc[1], rtc[0]);
+  } else if (twiWritten) {
+    writeTrace("rtc < control %02X", rtc[7]);
+  }
+  twiWritten = false;
+}
+
+/*
+  The firmware writes TWCR with TWINT and TWEN set to start the next step of
+  a transfer. The model clears TWINT while the step runs, and clears TWEN
+  when it sets TWINT again, so that a completed step can be told from the
+  next one.
+*/
+static void watchTwi(void) {
+  uint8_t control = TWCR;
+  if (control == 0 && twiState != TWI_IDLE) {
+    twiState = TWI_IDLE;
+    twiAt = NEVER;
+    nextEvent = 0;
+    return;
+  }
+  if ((control & (_BV(TWINT) | _BV(TWEN))) != (_BV(TWINT) | _BV(TWEN))) {
+    return;
+  }
+  TWCR = control & ~_BV(TWINT);
+  nextEvent = 0;
+  uint16_t bitCycles = 16 + 2 * TWBR;
+  bool answers = hostCycles >= nackUntil;
+  if (control & _BV(TWSTO)) {
+    TWCR = _BV(TWEN);
+    if (twiState == TWI_WRITE) {
+      traceRtcWrite();
+    }
+    twiState = TWI_IDLE;
+    return;
+  }
+  if (control & _BV(TWSTA)) {
+    twiStatus = twiState == TWI_IDLE ? 0x08 : 0x10;
+    twiState = TWI_ADDRESS;
+    twiAt = hostCycles + bitCycles;
+  } else if (twiState == TWI_ADDRESS) {
+    bool read = TWDR & 1;
+    if ((TWDR >> 1) == DS1307_ADDRESS && answers) {
+      twiStatus = read ? 0x40 : 0x18;
+      twiState = read ? TWI_READ : TWI_WRITE;
+      twiPointerSet = false;
+    } else {
+      twiStatus = read ? TW_MR_SLA_NACK : TW_MT_SLA_NACK;
+    }
+    twiAt = hostCycles + 9 * bitCycles;
+  } else if (twiState == TWI_WRITE) {
+    if (!twiPointerSet) {
+      twiPointer = TWDR % DS1307_SIZE;
+      twiFirst = twiPointer;
+      twiPointerSet = true;
+    } else {
+      /* the divider restarts on the acknowledge of the seconds */
+      if (twiPointer == 0) {
+	secondAt = hostCycles + 9 * bitCycles;
+	tickRtc();
+      }
+      rtc[twiPointer] = TWDR;
+      twiPointer = (twiPointer + 1) % DS1307_SIZE;
+      twiWritten = true;
+    }
+    twiStatus = 0x28;
+    twiAt = hostCycles + 9 * bitCycles;
+  } else if (twiState == TWI_READ) {
+    twiStatus = control & _BV(TWEA) ? 0x50 : 0x58;
+    twiAt = hostCycles + 9 * bitCycles;
+  }
+  if (hostCycles < hangUntil) {
+    twiAt = NEVER;
+  }
+}
+
+static void completeTwi(void) {
+  if (twiState == TWI_READ && (twiStatus == 0x50 || twiStatus == 0x58)) {
+    TWDR = rtc[twiPointer];
+    twiPointer = (twiPointer + 1) % DS1307_SIZE;
+  }
+  TWSR = twiStatus;
+  TWCR = _BV(TWINT) | (TWCR & _BV(TWIE));
+  twiAt = NEVER;
+}
+
+static void setDcf77Bcd(uint8_t from, uint8_t to, uint8_t value, int8_t parity) {
+  uint8_t bcd = toBcd(value);
+  uint8_t ones = 0;
+  for (uint8_t i = from; i <= to; i += 1) {
+    dcf77Bits[i] = bcd >> (i - from) & 1;
+    ones += dcf77Bits[i];
+  }
+  if (parity >= 0) {
+    dcf77Bits[parity] = ones % 2;
+  }
+}
+
+/*
+  Encodes the minute that starts at the end of the given minute of the
+  signal: 100 ms pulses for 0 and 200 ms pulses for 1, and no pulse in the
+  last second.
+*/
+static void planDcf77(uint16_t minute) {
+  uint8_t time[7] = { 0, dcf77Time[5], dcf77Time[4], dcf77Time[3], dcf77Time[2], dcf77Time[1], dcf77Time[0] };
+  for (uint32_t i = 0; i < minute * 60UL; i += 1) {
+    advanceTime(time);
+  }
+  memset(dcf77Bits, 0, sizeof(dcf77Bits));
+  dcf77Bits[20] = 1;
+  setDcf77Bcd(21, 27, time[1], 28);
+  setDcf77Bcd(29, 34, time[2], 35);
+  setDcf77Bcd(36, 41, time[4], -1);
+  setDcf77Bcd(42, 44, time[3], -1);
+  setDcf77Bcd(45, 49, time[5], -1);
+  setDcf77Bcd(50, 57, time[6], -1);
+  uint8_t ones = 0;
+  for (uint8_t i = 36; i < 58; i += 1) {
+    ones += dcf77Bits[i];
+  }
+  dcf77Bits[58] = ones % 2;
+  dcf77Minute = minute;
+}
+
+static void tickDcf77(void) {
+  if (hostCycles >= dcf77End) {
+    dcf77Level = false;
+    dcf77At = NEVER;
+    return;
+  }
+  uint64_t offset = hostCycles - dcf77Start;
+  uint16_t minute = offset / MINUTE;
+  uint8_t second = offset % MINUTE / CYCLES_PER_S;
+  uint64_t secondStart = dcf77Start + minute * MINUTE + second * CYCLES_PER_S;
+  if (minute != dcf77Minute) {
+    planDcf77(minute);
+  }
+  uint64_t pulseEnd = secondStart + (dcf77Bits[second < 59 ? second : 0] ? 200 : 100) * CYCLES_PER_MS;
+  dcf77Level = second < 59 && hostCycles < pulseEnd;
+  dcf77At = dcf77Level ? pulseEnd : secondStart + CYCLES_PER_S;
+}
+
+static uint64_t getByteCycles(void) {
+  uint16_t ubrr = (uint16_t) UBRR0H << 8 | UBRR0L;
+  return 10 * 8 * (ubrr + 1UL);
+}
+
+/* The bytes must be queued in the order they arrive. */
+static void queueByte(uint64_t at, uint8_t byte) {
+  if (rxCount == UART_BYTES) {
+    fprintf(stderr, "replay: more than %u bytes to receive\n", UART_BYTES);
+    exit(2);
+  }
+  rxBytes[rxCount++] = (transfer_t) { at, byte };
+  rxAt = rxBytes[rxNext].at;
+  nextEvent = 0;
+}
+
+static void receiveByte(void) {
+  if (rxPending) {
+    overruns += 1;
+  } else {
+    rxByte = rxBytes[rxNext].byte;
+    rxPending = true;
+  }
+  rxNext += 1;
+  rxAt = rxNext < rxCount ? rxBytes[rxNext].at : NEVER;
+}
+
+/*
+  UDR0 is free again as soon as its byte moves on to the shift register,
+  once the previous byte has been sent.
+*/
+static void transmitByte(uint8_t byte) {
+  uint64_t start = hostCycles > txEnd ? hostCycles : txEnd;
+  txEnd = start + getByteCycles();
+  txFree = start;
+  if (node.transfers < UART_BYTES) {
+    node.sent[node.transfers++] = (transfer_t) { txEnd, byte };
+  }
+  if (byte == '\n') {
+    txLine[txLength] = 0;
+    writeTrace("uart < %s", txLine);
+    txLength = 0;
+  } else if (byte != '\r' && txLength < LINE_SIZE - 1) {
+    txLine[txLength++] = byte;
+  }
+}
+
+/* Returns the 12 bit grayscale value of a channel in the data of a row. */
+static uint16_t getChannelValue(const uint8_t row[GS_DATA_SIZE], uint8_t channel) {
+  uint8_t position = CHANNELS - 1 - channel;
+  const uint8_t* data = &row[position * 3 / 2];
+  return position % 2 ? (data[0] & 0x0F) << 8 | data[1] : data[0] << 4 | data[1] >> 4;
+}
+
+static uint16_t getLitChannels(const uint8_t row[GS_DATA_SIZE]) {
+  uint16_t lit = 0;
+  for (uint8_t channel = 0; channel < 16; channel += 1) {
+    lit |= getChannelValue(row, channel) ? _BV(channel) : 0;
+  }
+  return lit;
+}
+
+static void traceFrame(void) {
+  writeTrace("frame");
+  for (uint8_t i = 0; i < ROWS; i += 1) {
+    fprintf(trace, "          %u ", i);
+    for (uint8_t channel = 0; channel < 16; channel += 1) {
+      fprintf(trace, " %03X", getChannelValue(latched[i], channel));
+    }
+    fputc('\n', trace);
+  }
+}
+
+static uint32_t updateCrc(uint32_t value, uint8_t byte) {
+  value ^= byte;
+  for (uint8_t i = 0; i < 8; i += 1) {
+    value = value & 1 ? (value >> 1) ^ 0xEDB88320 : value >> 1;
+  }
+  return value;
+}
+
+static uint64_t getTimer0Cycles(void) {
+  uint16_t prescaler = TCCR0B == (_BV(CS02) | _BV(CS00)) ? 1024 : TCCR0B == _BV(CS02) ? 256 : 0;
+  return (OCR0A + 1UL) * prescaler;
+}
+
+/*
+  The TLC5940 shows the row that was shifted in by the previous ISR. Until
+  SETTLED_MS, every row notes when its words and its data last changed.
+*/
+static void latchRowData(void) {
+  if (firstRefreshEnd == NEVER) {
+    firstRefreshEnd = hostCycles + (ROWS - 1) * getTimer0Cycles();
+  }
+  if (memcmp(latched[latchRow], shifted, GS_DATA_SIZE)) {
+    if (hostCycles < SETTLED_MS * CYCLES_PER_MS) {
+      if (getLitChannels(latched[latchRow]) != getLitChannels(shifted)) {
+	litSince[latchRow] = hostCycles;
+      }
+      settledSince[latchRow] = hostCycles;
+    }
+    memcpy(latched[latchRow], shifted, GS_DATA_SIZE);
+    changes += 1;
+    crc = updateCrc(crc, latchRow);
+    for (uint8_t i = 0; i < GS_DATA_SIZE; i += 1) {
+      crc = updateCrc(crc, shifted[i]);
+    }
+  }
+}
+
+static void shiftRowData(void) {
+  latchRow = (latchRow + 1) % ROWS;
+  for (uint8_t i = 0; i < GS_DATA_SIZE; i += 1) {
+    shifted[i] = gsData[latchRow][i];
+  }
+}
+
+/*
+  Restarts Timer0 when the firmware changes its mode, and the latches when
+  it clears OCF0A, which it does after it shifted the first row to restart
+  the refresh.
+*/
+static void watchTimer0(void) {
+  uint32_t config = (uint32_t) (TIMSK0 & _BV(OCIE0A)) << 16 | TCCR0B << 8 | OCR0A;
+  bool restarted = TIFR0 & _BV(OCF0A);
+  if (config == timer0Config && !restarted) {
+    return;
+  }
+  if (restarted) {
+    TIFR0 = 0;
+    timer0Pending = false;
+    latchRow = ROWS - 1;
+    shiftRowData();
+  }
+  timer0Config = config;
+  nextEvent = 0;
+  uint64_t cycles = getTimer0Cycles();
+  timer0At = cycles && TIMSK0 & _BV(OCIE0A) ? hostCycles + cycles : NEVER;
+}
+
+static void printFrameChanges(void) {
+  if (changes) {
+    writeTrace("rows %u changed, crc %08X", changes, (unsigned) crc);
+  }
+  changes = 0;
+  crc = 0;
+}
+
+static void readBaseline(uint32_t baseline[REPORTS]) {
+  FILE* file = fopen(baselineFile, "r");
+  char name[16];
+  unsigned long value;
+  if (!file) {
+    return;
+  }
+  while (fscanf(file, "%15s %lu", name, &value) == 2) {
+    for (uint8_t i = 0; i < REPORTS; i += 1) {
+      if (!strcmp(name, reportNames[i])) {
+	baseline[i] = value;
+      }
+    }
+  }
+  fclose(file);
+}
+
+/*
+  Ends the replay: reports the profiles and exits with 1 if one of them is
+  over its budget or more than BASELINE_MARGIN percent over its baseline.
+*/
+static void finish(void) {
+  ended = true;
+  if (chainOutput >= 0) {
+    bool written = write(chainOutput, &node, sizeof(node)) == sizeof(node);
+    exit(written && !overruns ? 0 : 1);
+  }
+  printFrameChanges();
+  traceFrame();
+  writeTrace("end");
+  fclose(trace);
+
+  for (uint8_t i = 0; i < PROFILES; i += 1) {
+    maxima[i] = getProfileCycles(i);
+  }
+  for (uint8_t i = 0; i < ROWS; i += 1) {
+    maxima[REPORT_STARTUP] = litSince[i] > maxima[REPORT_STARTUP] ? litSince[i] : maxima[REPORT_STARTUP];
+    maxima[REPORT_SETTLED] = settledSince[i] > maxima[REPORT_SETTLED] ? settledSince[i] : maxima[REPORT_SETTLED];
+  }
+  uint32_t baseline[REPORTS] = { 0 };
+  readBaseline(baseline);
+  bool passed = true;
+  for (uint8_t i = 0; i < REPORTS; i += 1) {
+    uint32_t limit = baseline[i] + baseline[i] * BASELINE_MARGIN / 100;
+    printf("replay  %-8s %6lu cycles, budget %6lu, baseline %6lu\n", reportNames[i], (unsigned long) maxima[i],
+           (unsigned long) budgets[i], (unsigned long) baseline[i]);
+    if (budgets[i] && maxima[i] > budgets[i]) {
+      printf("replay: %s is over its budget\n", reportNames[i]);
+      passed = false;
+    } else if (!baseline[i] || maxima[i] > limit) {
+      printf("replay: %s is more than %u%% over its baseline in %s\n", reportNames[i], BASELINE_MARGIN, baselineFile);
+      passed = false;
+    }
+  }
+  if (maxima[REPORT_STARTUP] > firstRefreshEnd) {
+    printf("replay: the first refresh ended at %lu cycles without the words\n", (unsigned long) firstRefreshEnd);
+    passed = false;
+  }
+  if (overruns) {
+    printf("replay: %u received bytes were overrun\n", overruns);
+    passed = false;
+  }
+  exit(passed ? 0 : 1);
+}
+
+static uint8_t parseDecimal(const char* digits, uint8_t count) {
+  uint8_t value = 0;
+  for (uint8_t i = 0; i < count; i += 1) {
+    value = value * 10 + digits[i] - '0';
+  }
+  return value;
+}
+
+static void runStep(const char* action) {
+  char argument[LINE_SIZE];
+  unsigned long value;
+  unsigned count;
+  if (!strcmp(action, "frame")) {
+    printFrameChanges();
+    traceFrame();
+  } else if (!strcmp(action, "end")) {
+    finish();
+  } else if (!strncmp(action, "uart ", 5)) {
+    char line[LINE_SIZE];
+    writeTrace("uart > %s", action + 5);
+    snprintf(line, sizeof(line), "%s\r\n", action + 5);
+    uint64_t at = hostCycles;
+    for (uint8_t i = 0; line[i]; i += 1) {
+      at += getByteCycles();
+      queueByte(at, line[i]);
+    }
+  } else if (sscanf(action, "rtc nack %lu", &value) == 1) {
+    writeTrace("%s", action);
+    nackUntil = hostCycles + value * CYCLES_PER_MS;
+  } else if (sscanf(action, "rtc hang %lu", &value) == 1) {
+    writeTrace("%s", action);
+    hangUntil = hostCycles + value * CYCLES_PER_MS;
+  } else if (sscanf(action, "dcf77 %11s %u", argument, &count) == 2 && strlen(argument) == 11) {
+    writeTrace("%s", action);
+    static const uint8_t offsets[] = { 0, 2, 4, 6, 7, 9 };
+    for (uint8_t i = 0; i < 6; i += 1) {
+      dcf77Time[i] = parseDecimal(argument + offsets[i], i == 3 ? 1 : 2);
+    }
+    if (!isDcf77Enabled()) {
+      initDcf77();
+    }
+    dcf77Start = hostCycles;
+    dcf77End = hostCycles + count * MINUTE;
+    dcf77Minute = UINT16_MAX;
+    tickDcf77();
+  }
+}
+
+/* Brings the registers up to date that the firmware reads. */
+static void updateRegisters(void) {
+  OCR1A = (uint16_t) OCR1AH << 8 | OCR1AL;
+  uint64_t period = (OCR1A + 1UL) * 8;
+  if (timer1At == NEVER && TCCR1B & _BV(CS11)) {
+    timer1At = hostCycles + period;
+    nextEvent = 0;
+  }
+  if (timer1At != NEVER) {
+    TCNT1 = (period - (timer1At - hostCycles)) / 8 % (OCR1A + 1UL);
+  }
+  SPSR |= _BV(SPIF);
+  SPDR = 0;
+  if (sqw != sqwPin && PCICR & _BV(PCIE2) && PCMSK2 & _BV(PCINT18)) {
+    pcintPending = true;
+  }
+  sqwPin = sqw;
+  PIND = _BV(PD0) | (sqw ? _BV(PD2) : 0) | (dcf77Level ? _BV(PD7) : 0);
+  if (!udrie && UCSR0B & _BV(UDRIE0)) {
+    nextEvent = 0;
+  }
+  udrie = UCSR0B & _BV(UDRIE0);
+  watchTimer0();
+  watchTwi();
+}
+
+static uint64_t getNextEvent(void) {
+  uint64_t next = stepAt;
+  uint64_t times[] = { windowAt, timer1At, timer0At, rtcAt, twiAt, dcf77At, rxAt };
+  for (uint8_t i = 0; i < sizeof(times) / sizeof(times[0]); i += 1) {
+    next = times[i] < next ? times[i] : next;
+  }
+  if (UCSR0B & _BV(UDRIE0) && txFree < next) {
+    next = txFree;
+  }
+  return next > hostCycles ? next : hostCycles + 1;
+}
+
+static void runEvents(void) {
+  if (hostCycles >= timer1At) {
+    TIFR1 |= _BV(OCF1A);
+    timer1At += (OCR1A + 1UL) * 8;
+  }
+  if (hostCycles >= timer0At) {
+    timer0Pending = true;
+    timer0Compare = timer0At;
+    timer0At += getTimer0Cycles();
+  }
+  if (hostCycles >= rtcAt) {
+    tickRtc();
+  }
+  if (hostCycles >= twiAt) {
+    completeTwi();
+  }
+  if (hostCycles >= dcf77At) {
+    tickDcf77();
+  }
+  if (hostCycles >= rxAt) {
+    receiveByte();
+  }
+  if (hostCycles >= windowAt) {
+    printFrameChanges();
+    windowAt += CYCLES_PER_S;
+  }
+  while (hostCycles >= stepAt) {
+    const char* action = steps[nextStep].action;
+    nextStep += 1;
+    stepAt = nextStep < stepCount ? steps[nextStep].ms * CYCLES_PER_MS : NEVER;
+    runStep(action);
+  }
+}
+
+/*
+  The events only run when one is due or the firmware started one, and
+  firmware code that they call, like initDcf77, only sees the registers
+  updated.
+*/
+static void runModels(void) {
+  updateRegisters();
+  if (!modelling && hostCycles >= nextEvent) {
+    modelling = true;
+    runEvents();
+    modelling = false;
+    updateRegisters();
+    nextEvent = getNextEvent();
+  }
+}
+
+static bool isTwiPending(void) {
+  return (TWCR & (_BV(TWINT) | _BV(TWIE) | _BV(TWEN))) == (_BV(TWINT) | _BV(TWIE));
+}
+
+static bool isPending(void) {
+  return pcintPending || (TIFR1 & _BV(OCF1A) && TIMSK1 & _BV(OCIE1A)) || timer0Pending
+    || (rxPending && UCSR0B & _BV(RXCIE0)) || (UCSR0B & _BV(UDRIE0) && hostCycles >= txFree) || isTwiPending();
+}
+
+/*
+  Calls the ISR that is pending with the highest priority. Returns false if
+  none is.
+*/
+static bool dispatch(void) {
+  uint64_t start = hostCycles;
+  if (pcintPending) {
+    pcintPending = false;
+    PCINT2_vect();
+  } else if (TIFR1 & _BV(OCF1A) && TIMSK1 & _BV(OCIE1A)) {
+    TIFR1 &= ~_BV(OCF1A);
+    TIMER1_COMPA_vect();
+  } else if (timer0Pending) {
+    timer0Pending = false;
+    if (start - timer0Compare > maxima[REPORT_LATENCY]) {
+      maxima[REPORT_LATENCY] = start - timer0Compare;
+    }
+    latchRowData();
+    TIMER0_COMPA_vect();
+    shiftRowData();
+  } else if (rxPending && UCSR0B & _BV(RXCIE0)) {
+    rxPending = false;
+    UDR0 = rxByte;
+    USART_RX_vect();
+  } else if (UCSR0B & _BV(UDRIE0) && hostCycles >= txFree) {
+    USART_UDRE_vect();
+    if (UCSR0B & _BV(UDRIE0)) {
+      transmitByte(UDR0);
+    }
+  } else if (isTwiPending()) {
+    TWI_vect();
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/*
+  The ISRs run with interrupts disabled, and while one runs, the handler
+  only keeps the models and registers going.
+*/
+static uint64_t runHardware(void) {
+  if (ended) {
+    return NEVER;
+  }
+  runModels();
+  if (!dispatching && isPending()) {
+    dispatching = true;
+    uint8_t enabled = hostDisableInterrupts();
+    while (enabled && dispatch()) {
+      nextEvent = 0;
+      runModels();
+    }
+    hostRestoreInterrupts(enabled);
+    dispatching = false;
+  }
+  return nextEvent > hostCycles ? nextEvent : hostCycles + 1;
+}
+
+static void runFirmware(void) {
+  tickRtc();
+  stepAt = steps[0].ms * CYCLES_PER_MS;
+  resetCause = _BV(PORF);
+  writeTrace("reset");
+
+  hostDisableInterrupts();
+  hostBlockCycles = BLOCK_CYCLES;
+  hostStartClock(runHardware);
+  firmwareMain();
+}
+
+/*
+  Runs one node of a chain in a child process, which feeds it what the
+  previous node sent and passes back what the node did. Node n starts n
+  times 13 seconds and 0.29 seconds behind the master, whose RTC starts at
+  12:00:25, so that it sends its first sync frame after 5 seconds. A node
+  runs until it has relayed the time, the last one until it has ticked a
+  few times after it was synced.
+*/
+static bool runNode(uint8_t index, bool last, node_t* result) {
+  uint8_t minutes = last ? index - 1 : index;
+  const step_t end = { (minutes * 60UL + CHAIN_SECONDS) * 1000, "end" };
+  int output[2];
+  if (pipe(output)) {
+    return false;
+  }
+  fflush(stdout);
+  pid_t child = fork();
+  if (child == 0) {
+    close(output[0]);
+    chainOutput = output[1];
+    for (uint16_t i = 0; i < result->transfers; i += 1) {
+      queueByte(result->sent[i].at, result->sent[i].byte);
+    }
+    uint32_t second = 12 * 3600UL + 25 - index * 13;
+    const uint8_t start[] = { toBcd(second % 60), toBcd(second / 60 % 60), toBcd(second / 3600), 5, 0x14, 0x06, 0x13, 0x00 };
+    memcpy(rtc, start, sizeof(start));
+    secondAt = index * 290 * CYCLES_PER_MS;
+    settings.sync = index ? SYNC_FOLLOWER : SYNC_MASTER;
+    saveSettings();
+    steps = &end;
+    stepCount = 1;
+    runFirmware();
+    exit(1);
+  }
+  close(output[1]);
+  size_t received = 0;
+  ssize_t count = 1;
+  while (child > 0 && received < sizeof(node_t) && count > 0) {
+    count = read(output[0], (uint8_t*) result + received, sizeof(node_t) - received);
+    received += count > 0 ? count : 0;
+  }
+  close(output[0]);
+  int status;
+  return waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0 && received == sizeof(node_t);
+}
+
+/*
+  Compares the SQW edges of every follower after it was synced with those
+  of the master, which ticks exactly once per second.
+*/
+static int runChain(uint8_t nodes) {
+  static node_t result;
+  edge_t master = { 0, 0 };
+  bool passed = true;
+  double worst = 0;
+  for (uint8_t i = 0; i < nodes; i += 1) {
+    if (!runNode(i, i == nodes - 1, &result)) {
+      printf("chain: node %u failed\n", i);
+      return 1;
+    }
+    if (i == 0) {
+      master = result.ticks[0];
+      continue;
+    }
+    double skew = 0;
+    bool synced = false;
+    for (uint8_t j = 0; j < result.edges; j += 1) {
+      if (result.writtenAt && result.ticks[j].at > result.writtenAt) {
+	int64_t expected = master.at + ((int64_t) result.ticks[j].second - master.second) * CYCLES_PER_S;
+	double offset = (double) ((int64_t) result.ticks[j].at - expected) / CYCLES_PER_MS;
+	if (!synced || fabs(offset) > fabs(skew)) {
+	  skew = offset;
+	}
+	synced = true;
+      }
+    }
+    if (!synced) {
+      printf("chain   node %u  not synced\n", i);
+      passed = false;
+      continue;
+    }
+    printf("chain   node %u  synced at %7.3f s, skew %+7.3f ms\n", i, (double) result.writtenAt / CYCLES_PER_S, skew);
+    worst = fabs(skew) > worst ? fabs(skew) : worst;
+  }
+  printf("chain   %u nodes, worst skew %.3f ms, limit %u ms\n", nodes, worst, CHAIN_SKEW_MS);
+  return passed && worst < CHAIN_SKEW_MS ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc == 3 && !strcmp(argv[1], "--chain") && atoi(argv[2]) > 1) {
+    return runChain(atoi(argv[2]));
+  }
+  if (argc != 3 || !(trace = fopen(argv[1], "w"))) {
+    fprintf(stderr, "usage: replay TRACE BASELINE\n       replay --chain NODES\n");
+    return 2;
+  }
+  baselineFile = argv[2];
+
+  static const uint8_t start[] = { 0x50, 0x59, 0x07, 5, 0x14, 0x06, 0x13, 0x00 };
+  memcpy(rtc, start, sizeof(start));
+  runFirmware();
+  return 1;
+}
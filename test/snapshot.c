@@ -0,0 +1,363 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <util/twi.h>
+#include "host.h"
+
+/*
+  main.c is built into this harness with its main renamed, so that getTime
+  and the ISRs can be called from here, and with barrier() calling
+  reachBarrier, which is declared before.
+*/
+static void reachBarrier(const char* function);
+
+#pragma pack(push, 1)
+#define main firmwareMain
+#define barrier() reachBarrier(__func__)
+#include "main.c"
+#undef main
+#pragma pack(pop)
+
+/*
+  Races the code of the main loop that reads or posts the time against the
+  ISRs that write it. The harness is built with -fsanitize-coverage=trace-pc,
+  and the points of a call are its basic blocks, which the clock of host.c
+  counts, and the barriers. Every case runs once per point with an interrupt
+  injected there, until the call completes before the interrupt is due. None
+  of these calls disables interrupts, so the injected ISR runs right away.
+
+  On the host, a copy of the time is a single block, while the AVR copies it
+  byte by byte. So at a barrier, every case also runs once for each byte
+  after which the interrupt could hit the copy next to the barrier: getTime
+  then copies the time with the bytes before that one as they were before
+  the ISR, and the ISR sees the time posted by setTime with the bytes from
+  that one on as they were before.
+
+  getTime races the SQW interrupt at 23:59:59, which carries the seconds into
+  the minutes and hours, and must return the time before or after it. A plain
+  copy of the time must tear at some block, which shows that the injection
+  hits the copy.
+
+  A t command races the completion of an RTC read that was started before it
+  and the Timer1 ISR that applies posted times, while an older time is still
+  pending. A read that completes while a time is pending must not change the
+  time, the Timer1 ISR must only apply whole times, and once the command has
+  returned and the next tick has run, the time and the RTC must hold the time
+  the command set.
+*/
+
+#define DS1307_SIZE  8
+
+#define TIME_ARGUMENT  "130615120000"
+
+void TIMER1_COMPA_vect(void);
+void TWI_vect(void);
+void USART_UDRE_vect(void);
+
+static const time_t start = {
+  .seconds = 59, .minutes = 59, .hours = 23, .day = 14, .month = 6, .year = 13, .dayOfWeek = 5,
+};
+
+static const time_t advanced = {
+  .seconds = 0, .minutes = 0, .hours = 0, .day = 14, .month = 6, .year = 13, .dayOfWeek = 5,
+};
+
+static const time_t stale = {
+  .seconds = 58, .minutes = 59, .hours = 23, .day = 14, .month = 6, .year = 13, .dayOfWeek = 5,
+};
+
+static const time_t older = {
+  .seconds = 0, .minutes = 30, .hours = 8, .day = 1, .month = 1, .year = 12, .dayOfWeek = 7,
+};
+
+static const time_t requested = {
+  .seconds = 0, .minutes = 0, .hours = 12, .day = 15, .month = 6, .year = 13, .dayOfWeek = 6,
+};
+
+static void (*injection)(void);
+static uint16_t injectAt;
+static uint8_t tearAt;
+static uint16_t points;
+static bool atBarrier;
+static time_t restoredTime;
+static bool restoreTime;
+static bool failed;
+
+static uint8_t rtc[DS1307_SIZE];
+static uint8_t rtcPointer;
+static bool twiStarted;
+static bool twiAddress;
+static bool twiPointer;
+static bool twiReading;
+static time_t rtcRead;
+
+static bool isTime(const time_t* value, const time_t* expected) {
+  return memcmp(value, expected, sizeof(time_t)) == 0;
+}
+
+static void fail(const char* message) {
+  if (!failed) {
+    printf("snapshot: %s at point %u, byte %u\n", message, injectAt, tearAt);
+  }
+  failed = true;
+}
+
+/* Not traced itself, since the blocks it runs would call it again. */
+__attribute__ ((no_sanitize_coverage)) static bool isDue(void) {
+  return injection && points++ == injectAt;
+}
+
+__attribute__ ((no_sanitize_coverage)) static void interrupt(void) {
+  void (*isr)(void) = injection;
+  injection = 0;
+  isr();
+}
+
+__attribute__ ((no_sanitize_coverage)) static uint64_t countBlock(void) {
+  if (isDue()) {
+    interrupt();
+  }
+  return UINT64_MAX;
+}
+
+/*
+  A time that getTime copies torn is whole again at the next barrier, which
+  comes before the next copy.
+*/
+__attribute__ ((no_sanitize_coverage)) static void reachBarrier(const char* function) {
+  if (restoreTime) {
+    time = restoredTime;
+    restoreTime = false;
+  }
+  if (!isDue()) {
+    return;
+  }
+  atBarrier = true;
+  if (strcmp(function, "getTime") == 0) {
+    time_t before = time;
+    interrupt();
+    restoredTime = time;
+    restoreTime = true;
+    memcpy(&time, &before, tearAt);
+  } else if (strcmp(function, "setTime") == 0) {
+    time_t posted = requestedTime;
+    memcpy(&requestedTime, &requested, tearAt);
+    interrupt();
+    requestedTime = posted;
+  } else {
+    interrupt();
+  }
+}
+
+/*
+  Returns false if the call completed before the interrupt was due, and sets
+  atBarrier if it was due at a barrier.
+*/
+static bool inject(void (*isr)(void), uint16_t point, uint8_t tear, void (*call)(void)) {
+  points = 0;
+  injectAt = point;
+  tearAt = tear;
+  atBarrier = false;
+  injection = isr;
+  call();
+  if (restoreTime) {
+    time = restoredTime;
+    restoreTime = false;
+  }
+  bool injected = !injection;
+  injection = 0;
+  return injected;
+}
+
+/*
+  Runs prepare, the call with the interrupt injected at every point, and
+  check, and returns the number of points of the call.
+*/
+static uint16_t race(void (*prepare)(void), void (*isr)(void), void (*call)(void), void (*check)(void)) {
+  for (uint16_t point = 0;; point += 1) {
+    for (uint8_t tear = 0; tear < sizeof(time_t); tear += 1) {
+      prepare();
+      bool injected = inject(isr, point, tear, call);
+      check();
+      if (!injected) {
+        return point;
+      }
+      if (!atBarrier) {
+        break;
+      }
+    }
+  }
+}
+
+/*
+  Does the part of the DS1307 and the TWI hardware for the step of the
+  transfer that the firmware started last, and sets the status that the TWI
+  ISR gets next. Returns false when no transfer is running.
+*/
+static bool prepareTwi(void) {
+  if (isRtcIdle()) {
+    twiStarted = false;
+    return false;
+  }
+  uint8_t control = TWCR;
+  if (control & _BV(TWSTA)) {
+    TWSR = twiStarted ? TW_REP_START : TW_START;
+    twiStarted = true;
+    twiAddress = true;
+  } else if (twiAddress) {
+    twiAddress = false;
+    twiReading = TWDR & TW_READ;
+    twiPointer = !twiReading;
+    TWSR = twiReading ? TW_MR_SLA_ACK : TW_MT_SLA_ACK;
+  } else if (twiReading) {
+    TWDR = rtc[rtcPointer++ % DS1307_SIZE];
+    TWSR = control & _BV(TWEA) ? TW_MR_DATA_ACK : TW_MR_DATA_NACK;
+  } else if (twiPointer) {
+    twiPointer = false;
+    rtcPointer = TWDR;
+    TWSR = TW_MT_DATA_ACK;
+  } else {
+    rtc[rtcPointer++ % DS1307_SIZE] = TWDR;
+    TWSR = TW_MT_DATA_ACK;
+  }
+  return true;
+}
+
+static void runTwi(void) {
+  while (prepareTwi()) {
+    TWI_vect();
+  }
+}
+
+static void storeRead(time_t* time) {
+  rtcRead = *time;
+}
+
+static void setRtc(const time_t* time) {
+  writeTime((time_t*) time);
+  runTwi();
+}
+
+static void drainUart(void) {
+  while (bit_is_set(UCSR0B, UDRIE0)) {
+    USART_UDRE_vect();
+  }
+}
+
+static time_t snapshot;
+static uint16_t tornCopies;
+
+static void startCopy(void) {
+  time = start;
+}
+
+static void takeSnapshot(void) {
+  getTime(&snapshot);
+}
+
+static void copyTime(void) {
+  const volatile uint8_t* from = (const volatile uint8_t*) &time;
+  uint8_t* to = (uint8_t*) &snapshot;
+  for (uint8_t i = 0; i < sizeof(time_t); i += 1) {
+    to[i] = from[i];
+  }
+}
+
+/* The SQW interrupt also starts a read of the date at midnight. */
+static void checkSnapshot(void) {
+  runTwi();
+  if (!isTime(&snapshot, &start) && !isTime(&snapshot, &advanced)) {
+    fail("getTime returned a torn time");
+  }
+}
+
+static void checkCopy(void) {
+  runTwi();
+  if (!isTime(&snapshot, &start) && !isTime(&snapshot, &advanced)) {
+    tornCopies += 1;
+  }
+}
+
+static void completeRead(void) {
+  bool pending = timeRequested;
+  time_t before = time;
+  TWI_vect();
+  if (pending && !isTime(&time, &before)) {
+    fail("a read changed the time while a time was pending");
+  }
+}
+
+static void tick(void) {
+  TIMER1_COMPA_vect();
+  if (!isTime(&time, &start) && !isTime(&time, &older) && !isTime(&time, &requested)) {
+    fail("the Timer1 ISR applied a torn time");
+  }
+}
+
+static void startCommand(void) {
+  time = start;
+  setRtc(&start);
+  setTime(&older);
+}
+
+/* The RTC holds the stale time when the read starts, which is run up to its last step. */
+static void startCommandWithRead(void) {
+  startCommand();
+  setRtc(&stale);
+  readTime(&rtcCallback);
+  while (prepareTwi() && TW_STATUS != TW_MR_DATA_NACK) {
+    TWI_vect();
+  }
+}
+
+static void setTimeCommand(void) {
+  execute_command(COMMAND_TIME, TIME_ARGUMENT, strlen(TIME_ARGUMENT));
+}
+
+static void checkCommand(void) {
+  drainUart();
+  runTwi();
+  TIMER1_COMPA_vect();
+  runTwi();
+  readTime(&storeRead);
+  runTwi();
+  if (timeRequested || !isTime(&time, &requested)) {
+    fail("the time differs from the one set");
+  }
+  if (!isTime(&rtcRead, &requested)) {
+    fail("the RTC differs from the time set");
+  }
+}
+
+int main(void) {
+  hostStartClock(&countBlock);
+
+  uint16_t snapshotPoints = race(&startCopy, &secondCallback, &takeSnapshot, &checkSnapshot);
+  uint16_t copyPoints = race(&startCopy, &secondCallback, &copyTime, &checkCopy);
+  uint16_t readPoints = race(&startCommandWithRead, &completeRead, &setTimeCommand, &checkCommand);
+  uint16_t tickPoints = race(&startCommand, &tick, &setTimeCommand, &checkCommand);
+
+  printf("snapshot  getTime %u points, plain copy %u/%u points torn, t command %u points against a read, %u against a tick\n",
+         snapshotPoints, tornCopies, copyPoints, readPoints, tickPoints);
+  if (!tornCopies) {
+    printf("snapshot: the interrupts never hit a copy\n");
+    return 1;
+  }
+  return failed ? 1 : 0;
+}
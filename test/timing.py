@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+#
+#   Copyright 2012 Daniel A. Spilker
+#
+#   Licensed under the Apache License, Version 2.0 (the "License");
+#   you may not use this file except in compliance with the License.
+#   You may obtain a copy of the License at
+#
+#       http://www.apache.org/licenses/LICENSE-2.0
+#
+#   Unless required by applicable law or agreed to in writing, software
+#   distributed under the License is distributed on an "AS IS" BASIS,
+#   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#   See the License for the specific language governing permissions and
+#   limitations under the License.
+#
+
+"""Checks the row timing of the refresh modes against the TLC5940.
+
+Usage: timing.py [CLOCK [MAX_CHAIN]]
+
+GSCLK is the system clock on CLKO, so one cycle of the model is one
+grayscale clock. The TLC5940 starts counting GSCLK when BLANK falls, and an
+output with the grayscale value v stays on for the first v clocks. BLANK
+must stay low for at least as many clocks as the largest value the firmware
+sends, or the brightest outputs are cut short by the next row.
+
+For every mode in refreshModes of src/matrix.c, the model runs a sequence of
+rows with Timer0 in CTC mode, an interrupt response that varies by the
+cycles of the interrupted instruction or the wake from idle sleep, and the
+cycles the ISR spends with BLANK high. It fails unless the compare matches
+are exactly 2^bits clocks apart, the shortest time BLANK is low covers
+getGrayscaleMaximum(), and the next row is shifted before the following
+compare match for every chain length a mode is available with.
+
+The cycle counts are estimates from the instruction set summary for the code
+avr-gcc -Os generates for TIMER0_COMPA_vect. A row that starts late because
+another interrupt was running loses that delay at the top of its range, which
+the model does not cover.
+"""
+
+import random
+import re
+import sys
+
+# Interrupt response: pushing the PC and the jmp in the vector table.
+RESPONSE_CLOCKS = 4 + 3
+# A multi-cycle instruction is completed first, a wake from sleep adds four.
+RESPONSE_VARIATION = 4
+# From the compare match to BLANK high: the prologue and startProfile.
+PROLOGUE_CLOCKS = 2 * 14 + 12
+
+# TIMER0_COMPA_vect from setHigh(BLANK) up to and including setLow(BLANK).
+BLANK_STEPS = (
+    ('sbi BLANK', 2),
+    ('lds row, branch', 4),
+    ('anode pulse', 4),
+    ('rjmp', 2),
+    ('XLAT pulse', 4),
+    ('latchedRow', 6),
+    ('lds anodeSettle, branch', 3),
+    ('cbi BLANK', 2),
+)
+# From BLANK low to the first byte on the SPI.
+SHIFT_START_CLOCKS = 12
+# The rest of the ISR after shiftRow, with the status copy and the epilogue.
+EPILOGUE_CLOCKS = 2 * 14 + 40
+
+ROWS = 1000
+SEED = 1
+
+PRESCALERS = {'PRESCALER_256': 256, 'PRESCALER_1024': 1024}
+
+
+def read_matrix(path):
+    with open(path) as source:
+        text = source.read()
+    table = re.search(r'refreshModes\[REFRESH_MODES\] PROGMEM = \{(.*?)\n\};', text, re.S).group(1)
+    modes = [(PRESCALERS[p], int(c, 0), int(b), int(s))
+             for p, c, b, s in re.findall(r'\{ (\w+), (\w+), (\d+), (\d+) \}', table)]
+    constants = dict((name, int(value)) for name, value in
+                     re.findall(r'^#define (BLANK_CLOCKS|ANODE_SETTLE_US|SPI_BYTE_CLOCKS)\s+(\d+)$', text, re.M))
+    return modes, constants
+
+
+def blank_clocks(settle_clocks):
+    # the sbi takes effect at its end and the cbi at its end, and the settle
+    # path does not take the branch around the delay
+    clocks = sum(cycles for _, cycles in BLANK_STEPS) - 2
+    return clocks + settle_clocks - 1 if settle_clocks else clocks
+
+
+def simulate(row_clocks, high_clocks, rng):
+    """Returns the compare match distances and the BLANK low windows."""
+    matches = []
+    edges = []
+    for i in range(ROWS):
+        match = i * row_clocks
+        # the first half alternates the extremes, the second half is random
+        if i < ROWS // 2:
+            variation = RESPONSE_VARIATION * (i % 2)
+        else:
+            variation = rng.randint(0, RESPONSE_VARIATION)
+        high = match + RESPONSE_CLOCKS + variation + PROLOGUE_CLOCKS
+        matches.append(match)
+        edges.append((high, high + high_clocks))
+    periods = set(b - a for a, b in zip(matches, matches[1:]))
+    windows = [edges[i + 1][0] - edges[i][1] for i in range(len(edges) - 1)]
+    return periods, windows
+
+
+def main():
+    clock = int(sys.argv[1]) if len(sys.argv) > 1 else 8000000
+    max_chain = int(sys.argv[2]) if len(sys.argv) > 2 else 4
+    modes, constants = read_matrix('src/matrix.c')
+    rng = random.Random(SEED)
+    failed = False
+
+    print('mode  period  bits  high  window  maximum  cut  rows/s  chains')
+    for index, (prescaler, compare, bits, settle) in enumerate(modes):
+        row_clocks = (compare + 1) * prescaler
+        settle_clocks = constants['ANODE_SETTLE_US'] * clock // 1000000 if settle else 0
+        high_clocks = blank_clocks(settle_clocks)
+        periods, windows = simulate(row_clocks, high_clocks, rng)
+        window = min(windows)
+        maximum = (1 << bits) - constants['BLANK_CLOCKS'] - settle_clocks
+        cut = (1 << bits) - 1 - maximum
+
+        chains = []
+        for count in range(1, max_chain + 1):
+            shift_clocks = 24 * count * constants['SPI_BYTE_CLOCKS']
+            if row_clocks < 2 * shift_clocks and index != 0:
+                continue
+            busy = high_clocks + SHIFT_START_CLOCKS + shift_clocks + EPILOGUE_CLOCKS
+            if RESPONSE_CLOCKS + RESPONSE_VARIATION + PROLOGUE_CLOCKS + busy >= row_clocks:
+                print('mode %d: the ISR takes %d of %d clocks with %d TLC5940s' % (index, busy, row_clocks, count))
+                failed = True
+            chains.append(count)
+
+        print('%4d  %6d  %4d  %4d  %6d  %7d  %3d  %6d  %s' % (
+            index, row_clocks, bits, high_clocks, window, maximum, cut,
+            clock // row_clocks, ','.join(str(c) for c in chains)))
+        if periods != {1 << bits}:
+            print('mode %d: compare matches %s clocks apart instead of %d' % (index, sorted(periods), 1 << bits))
+            failed = True
+        if window < maximum:
+            print('mode %d: BLANK ends a row after %d clocks, before the value %d has' % (index, window, maximum))
+            failed = True
+    if failed:
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
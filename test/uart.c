@@ -0,0 +1,314 @@
+/*
+   Copyright 2012 Daniel A. Spilker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+
+/*
+  main.c is built into this harness with its main renamed, so that
+  handleUart can be driven from here, and with its calls of uart_getc and
+  uart_putc traced. Like the firmware headers, it is packed as on the AVR.
+*/
+#pragma pack(push, 1)
+#define main firmwareMain
+#define uart_getc traceGetc
+#define uart_putc tracePutc
+#include "main.c"
+#undef main
+#undef uart_getc
+#undef uart_putc
+#pragma pack(pop)
+
+uint8_t uart_getc(void);
+
+void uart_putc(uint8_t c);
+
+void USART_RX_vect(void);
+
+void USART_UDRE_vect(void);
+
+/*
+  Feeds the UART of the firmware at line rate and reports what becomes of
+  the input. Every interrupt from host.c is one byte time on the line, in
+  which the handler receives the next input byte and sends the next output
+  byte. The main loop calls handleUart every pollTicks byte times, about once
+  per millisecond like the firmware.
+
+  request sends each command after the answer to the previous one arrived,
+  flood sends the commands back to back, and fuzz sends random bytes with a
+  CR LF after about every 16 of them. fuzz never sends u and z, because the
+  firmware does not return from these commands.
+
+  Each byte that reaches the receive buffer is tagged with its line. An
+  answer belongs to the line of the last byte handleUart read before
+  execute_command wrote the command character, and must start with the
+  command of that line. The latency runs from the LF of a line to the LF of
+  its answer. Dropped counts the bytes lost in the receive buffer, discarded
+  the lines that were not answered.
+*/
+
+#define TICK_US       100
+#define HANG_TICKS    100000
+#define REPLY_TIMEOUT 2000
+#define REPLY_SIZE    64
+#define LINE_SIZE     24
+#define ROUNDS        20
+#define LINES         (ROUNDS * COMMANDS)
+#define FUZZ_BYTES    20000
+#define NO_LINE       0xFFFF
+
+#define MODE_REQUEST  0
+#define MODE_FLOOD    1
+#define MODE_FUZZ     2
+
+static const char* const commands[] = {
+  "v", "b", "b80", "t", "s00", "s05", "r", "e", "e02", "a00", "p", "f", "m",
+};
+
+#define COMMANDS (sizeof(commands) / sizeof(commands[0]))
+
+static volatile uint32_t tick;
+static volatile uint32_t lastPoll;
+
+static uint8_t mode;
+static char line[LINE_SIZE];
+static const char* sending;
+static uint16_t sendingLine;
+static uint16_t lines;
+static uint16_t linesLeft;
+static bool awaiting;
+static uint32_t sentTick;
+static uint32_t fuzzLeft;
+static uint32_t seed = 1;
+static bool fuzzLineEnd;
+
+static uint8_t lineCommands[LINES];
+static uint32_t lineTicks[LINES];
+static uint16_t bufferLines[256];
+static uint8_t bufferHead;
+static uint8_t bufferTail;
+static uint16_t readLine = NO_LINE;
+static uint16_t replyLines[256];
+static uint8_t replyHead;
+static uint8_t replyTail;
+static uint8_t reply[REPLY_SIZE];
+static uint8_t replyLength;
+
+static uint16_t answered;
+static uint16_t unexpected;
+static uint32_t latencies[LINES];
+static uint16_t latencyCount;
+
+uint8_t traceGetc(void) {
+  uint8_t c = uart_getc();
+  readLine = bufferLines[bufferTail++];
+  return c;
+}
+
+void tracePutc(uint8_t c) {
+  replyLines[replyHead++] = readLine;
+  uart_putc(c);
+}
+
+static uint8_t nextRandom(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static int nextFuzzByte(void) {
+  if (fuzzLineEnd) {
+    fuzzLineEnd = false;
+    lines += 1;
+    return LF;
+  }
+  if (!fuzzLeft) {
+    return -1;
+  }
+  fuzzLeft -= 1;
+  uint8_t byte = nextRandom();
+  if ((byte & 0x0F) == 0) {
+    fuzzLineEnd = true;
+    return CR;
+  }
+  byte = nextRandom();
+  return byte == COMMAND_UPDATE || byte == COMMAND_SYNC ? COMMAND_VERSION : byte;
+}
+
+static int nextByte(void) {
+  if (!*sending) {
+    sendingLine = NO_LINE;
+    if (mode == MODE_FUZZ) {
+      return nextFuzzByte();
+    }
+    if (!linesLeft || (mode == MODE_REQUEST && awaiting && tick - sentTick < REPLY_TIMEOUT)) {
+      return -1;
+    }
+    strcpy(line, commands[lines % COMMANDS]);
+    strcat(line, CRLF);
+    sending = line;
+    sendingLine = lines;
+    lineCommands[lines] = line[0];
+    lines += 1;
+    linesLeft -= 1;
+  }
+  uint8_t byte = *sending++;
+  if (!*sending && sendingLine != NO_LINE) {
+    lineTicks[sendingLine] = tick;
+    awaiting = true;
+    sentTick = tick;
+  }
+  return byte;
+}
+
+static void completeReply(void) {
+  uint16_t index = replyLines[replyTail++];
+  answered += 1;
+  awaiting = false;
+  if (index == NO_LINE) {
+    return;
+  }
+  if (reply[0] != lineCommands[index]) {
+    unexpected += 1;
+    return;
+  }
+  latencies[latencyCount++] = tick - lineTicks[index];
+}
+
+static void receiveByte(uint8_t byte) {
+  if (replyLength < REPLY_SIZE) {
+    reply[replyLength++] = byte;
+  }
+  if (byte == LF && replyLength >= 2 && reply[replyLength - 2] == CR) {
+    completeReply();
+    replyLength = 0;
+  }
+}
+
+static void tickUart(void) {
+  int byte = nextByte();
+  if (byte >= 0) {
+    uint16_t dropped = uart_dropped();
+    UDR0 = byte;
+    USART_RX_vect();
+    if (uart_dropped() == dropped) {
+      bufferLines[bufferHead++] = sendingLine;
+    }
+  }
+  if (bit_is_set(UCSR0B, UDRIE0)) {
+    bool sent = !uart_tx_idle();
+    USART_UDRE_vect();
+    if (sent) {
+      receiveByte(UDR0);
+    }
+  }
+  tick += 1;
+  if (tick - lastPoll > HANG_TICKS) {
+    hostAbort("uart: handleUart does not return\n");
+  }
+}
+
+static bool isDone(void) {
+  bool done;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    done = !*sending && !fuzzLineEnd && !fuzzLeft && !linesLeft && !uart_has_data() && uart_tx_idle();
+  }
+  return done;
+}
+
+static int compareLatencies(const void* a, const void* b) {
+  uint32_t x = *(const uint32_t*) a;
+  uint32_t y = *(const uint32_t*) b;
+  return x < y ? -1 : x > y;
+}
+
+static double toMilliseconds(uint32_t ticks, uint32_t baud) {
+  return ticks * 10000.0 / baud;
+}
+
+/*
+  Runs one scenario and prints its line of the report. Returns false if an
+  answer does not match its line, or if commands got lost although they were
+  not sent faster than they are answered.
+*/
+static bool run(const char* name, uint8_t runMode, uint32_t baud, uint8_t pollTicks) {
+  mode = runMode;
+  sending = CRLF;
+  sendingLine = NO_LINE;
+  lines = 0;
+  linesLeft = mode == MODE_FUZZ ? 0 : LINES;
+  fuzzLeft = mode == MODE_FUZZ ? FUZZ_BYTES : 0;
+  awaiting = false;
+  replyLength = 0;
+  answered = unexpected = latencyCount = 0;
+  uint16_t dropped = uart_dropped();
+
+  lastPoll = tick;
+  hostStartInterrupts(TICK_US, tickUart);
+  while (!isDone()) {
+    uint32_t now = tick;
+    lastPoll = now;
+    handleUart();
+    while (tick - now < pollTicks);
+  }
+  hostStopInterrupts();
+
+  dropped = uart_dropped() - dropped;
+  printf("%-8s %6lu %6u %8u", name, (unsigned long) baud, lines, answered);
+  if (mode == MODE_FUZZ) {
+    printf(" %9s %7u", "-", dropped);
+  } else {
+    printf(" %9u %7u", lines - answered, dropped);
+  }
+  if (latencyCount) {
+    qsort(latencies, latencyCount, sizeof(latencies[0]), compareLatencies);
+    printf(" %7.1f %7.1f %7.1f\n", toMilliseconds(latencies[latencyCount / 2], baud),
+           toMilliseconds(latencies[latencyCount * 99 / 100], baud), toMilliseconds(latencies[latencyCount - 1], baud));
+  } else {
+    printf(" %7s %7s %7s\n", "-", "-", "-");
+  }
+
+  if (unexpected) {
+    printf("%s: %u answers do not match their line\n", name, unexpected);
+    return false;
+  }
+  if (mode == MODE_REQUEST && (dropped || latencyCount != lines)) {
+    printf("%s: commands got lost\n", name);
+    return false;
+  }
+  return true;
+}
+
+int main(void) {
+  loadSettings();
+  initLog();
+  uart_init(settings.baud);
+
+  bool passed = true;
+  printf("scenario   baud  lines answered discarded dropped  p50 ms  p99 ms  max ms\n");
+  passed &= run("request", MODE_REQUEST, 9600, 1);
+  passed &= run("request", MODE_REQUEST, 57600, 6);
+  passed &= run("flood", MODE_FLOOD, 9600, 1);
+  passed &= run("flood", MODE_FLOOD, 57600, 6);
+  passed &= run("fuzz", MODE_FUZZ, 9600, 1);
+  passed &= run("fuzz", MODE_FUZZ, 57600, 6);
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+#
+#   Copyright 2012 Daniel A. Spilker
+#
+#   Licensed under the Apache License, Version 2.0 (the "License");
+#   you may not use this file except in compliance with the License.
+#   You may obtain a copy of the License at
+#
+#       http://www.apache.org/licenses/LICENSE-2.0
+#
+#   Unless required by applicable law or agreed to in writing, software
+#   distributed under the License is distributed on an "AS IS" BASIS,
+#   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#   See the License for the specific language governing permissions and
+#   limitations under the License.
+#
+
+"""Reports static cycle counts per function from an AVR disassembly.
+
+Usage: avr-objdump -d main.elf | avr_cycles.py [FUNCTION...]
+
+Prints one tab separated line per function, sorted by name:
+
+    function  bytes  instructions  cycles  branches  calls
+
+'cycles' is the sum of all instruction cycles of the function with no
+branch taken and no instruction skipped, so it is the cost of one straight
+pass through its code, not of a loop. 'branches' and 'calls' count the
+conditional branches and skips, and the calls, which each add cycles at
+runtime. The output is stable for an unchanged binary and can be diffed
+between commits. If functions are given, only those are reported.
+"""
+
+import re
+import sys
+
+# Cycle counts for the AVRe+ core of the ATmega88PA, see the instruction
+# set summary in the data sheet. Everything else takes a single cycle.
+CYCLES = {
+    'adiw': 2, 'sbiw': 2,
+    'mul': 2, 'muls': 2, 'mulsu': 2, 'fmul': 2, 'fmuls': 2, 'fmulsu': 2,
+    'ld': 2, 'ldd': 2, 'lds': 2, 'st': 2, 'std': 2, 'sts': 2,
+    'lpm': 3, 'elpm': 3, 'spm': 2,
+    'push': 2, 'pop': 2,
+    'cbi': 2, 'sbi': 2,
+    'rjmp': 2, 'ijmp': 2, 'jmp': 3,
+    'rcall': 3, 'icall': 3, 'call': 4,
+    'ret': 4, 'reti': 4,
+}
+
+BRANCHES = ('br', 'cpse', 'sbrc', 'sbrs', 'sbic', 'sbis')
+CALLS = ('rcall', 'icall', 'call')
+
+SYMBOL = re.compile(r'^[0-9a-f]+ <([^>]+)>:$')
+INSTRUCTION = re.compile(r'^\s+[0-9a-f]+:\t(?:[0-9a-f]{2} )+\s*\t(\S+)')
+OPCODE_BYTES = re.compile(r'^\s+[0-9a-f]+:\t((?:[0-9a-f]{2} )+)')
+
+
+def parse(lines):
+    functions = {}
+    current = None
+    for line in lines:
+        line = line.rstrip('\n')
+        match = SYMBOL.match(line)
+        if match:
+            current = functions.setdefault(match.group(1), [0, 0, 0, 0, 0])
+            continue
+        match = INSTRUCTION.match(line)
+        if not match or current is None:
+            continue
+        mnemonic = match.group(1)
+        current[0] += len(OPCODE_BYTES.match(line).group(1).split())
+        current[1] += 1
+        current[2] += CYCLES.get(mnemonic, 1)
+        if mnemonic.startswith(BRANCHES):
+            current[3] += 1
+        if mnemonic in CALLS:
+            current[4] += 1
+    return functions
+
+
+def main():
+    functions = parse(sys.stdin)
+    names = sys.argv[1:] or sorted(functions)
+    print('function\tbytes\tinstructions\tcycles\tbranches\tcalls')
+    for name in sorted(names):
+        values = functions.get(name)
+        if values is None:
+            # LTO and IPA clones carry suffixes such as .lto_priv.0
+            clones = [key for key in functions if key.split('.')[0] == name]
+            if clones:
+                values = functions[min(clones)]
+        if values is None:
+            # inlined or removed by the compiler
+            print('%s\t-\t-\t-\t-\t-' % name)
+        else:
+            print('\t'.join([name] + [str(value) for value in values]))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+#
+#   Copyright 2012 Daniel A. Spilker
+#
+#   Licensed under the Apache License, Version 2.0 (the "License");
+#   you may not use this file except in compliance with the License.
+#   You may obtain a copy of the License at
+#
+#       http://www.apache.org/licenses/LICENSE-2.0
+#
+#   Unless required by applicable law or agreed to in writing, software
+#   distributed under the License is distributed on an "AS IS" BASIS,
+#   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#   See the License for the specific language governing permissions and
+#   limitations under the License.
+#
+
+"""Compiles a human readable schedule into the clock's rule table.
+
+Usage: compile_schedule.py [--binary] [FILE]
+
+Each line of the schedule holds one rule, the first matching rule wins:
+
+    <days> <window> <action>...
+
+    days     Mon-Fri, Sat,Sun, Mon or *
+    window   07:30-18:00, 22:00-06:00 (spans midnight) or * (all day)
+    action   brightness=<0-255>, effect=<name>, blank, flash
+
+A rule without a brightness keeps the brightness set with the 'b' command,
+a rule without an effect keeps the configured effect.
+
+Example:
+
+    # lunch break, then office hours
+    Mon-Fri 12:00-12:01 flash
+    Mon-Fri 07:30-18:00 brightness=255 effect=wipe
+    *       *           blank
+
+Without --binary, one 'a' command per rule is written to standard output,
+ready to be sent to the clock. Unused rule slots are cleared. With --binary,
+the raw 64 byte table is written instead.
+"""
+
+import struct
+import sys
+
+RULES = 8
+RULE_UNUSED = 0x80
+RULE_BLANK = 0x01
+RULE_FLASH = 0x02
+RULE_KEEP_BRIGHTNESS = 0x04
+EFFECT_KEEP = 0xFF
+
+DAYS = ['mon', 'tue', 'wed', 'thu', 'fri', 'sat', 'sun']
+EFFECTS = ['none', 'wipe', 'typewriter', 'rain', 'sparkle']
+
+
+def parse_days(text):
+    if text == '*':
+        return 0x7F
+    mask = 0
+    for part in text.lower().split(','):
+        first, _, last = part.partition('-')
+        start = DAYS.index(first)
+        end = DAYS.index(last) if last else start
+        for day in range(start, end + 1):
+            mask |= 1 << day
+    return mask
+
+
+def parse_minute(text):
+    hours, minutes = text.split(':')
+    minute = int(hours) * 60 + int(minutes)
+    if not 0 <= minute <= 1440:
+        raise ValueError('invalid time %s' % text)
+    return minute % 1440
+
+
+def parse_window(text):
+    if text == '*':
+        return 0, 0
+    start, end = text.split('-')
+    return parse_minute(start), parse_minute(end)
+
+
+def parse_rule(line):
+    fields = line.split()
+    days = parse_days(fields[0])
+    start, end = parse_window(fields[1])
+    brightness = 0xFF
+    effect = EFFECT_KEEP
+    flags = RULE_KEEP_BRIGHTNESS
+    for action in fields[2:]:
+        name, _, value = action.partition('=')
+        if name == 'brightness':
+            brightness = int(value, 0)
+            flags &= ~RULE_KEEP_BRIGHTNESS
+        elif name == 'effect':
+            effect = EFFECTS.index(value)
+        elif name == 'blank':
+            flags |= RULE_BLANK
+        elif name == 'flash':
+            flags |= RULE_FLASH
+        else:
+            raise ValueError('unknown action %s' % action)
+    return struct.pack('<BHHBBB', days, start, end, brightness, effect, flags)
+
+
+def compile_schedule(source):
+    rules = []
+    for number, line in enumerate(source, 1):
+        line = line.split('#')[0].strip()
+        if not line:
+            continue
+        try:
+            rules.append(parse_rule(line))
+        except (ValueError, IndexError) as error:
+            raise SystemExit('line %d: %s' % (number, error))
+    if len(rules) > RULES:
+        raise SystemExit('at most %d rules are supported' % RULES)
+    unused = bytes([RULE_UNUSED | 0x7F]) + b'\xff' * 7
+    return rules + [unused] * (RULES - len(rules))
+
+
+def main(argv):
+    binary = '--binary' in argv
+    files = [arg for arg in argv[1:] if arg != '--binary']
+    source = open(files[0]) if files else sys.stdin
+    rules = compile_schedule(source)
+    if binary:
+        sys.stdout.buffer.write(b''.join(rules))
+    else:
+        for index, rule in enumerate(rules):
+            sys.stdout.write('a%02X%s\r\n' % (index, rule.hex().upper()))
+
+
+if __name__ == '__main__':
+    main(sys.argv)
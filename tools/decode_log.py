@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+#
+#   Copyright 2012 Daniel A. Spilker
+#
+#   Licensed under the Apache License, Version 2.0 (the "License");
+#   you may not use this file except in compliance with the License.
+#   You may obtain a copy of the License at
+#
+#       http://www.apache.org/licenses/LICENSE-2.0
+#
+#   Unless required by applicable law or agreed to in writing, software
+#   distributed under the License is distributed on an "AS IS" BASIS,
+#   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#   See the License for the specific language governing permissions and
+#   limitations under the License.
+#
+
+"""Converts the output of the 'l' command into CSV.
+
+Usage: decode_log.py [FILE]
+
+Reads the dump from FILE or standard input, one entry of 16 hex digits per
+line, and writes one CSV row per entry to standard output.
+"""
+
+import csv
+import re
+import sys
+
+EVENTS = {
+    0x01: 'boot',
+    0x02: 'dcf77_sync',
+    0x03: 'twi_error',
+    0x04: 'uart_overflow',
+    0x05: 'brightness',
+    0x06: 'thermal',
+}
+
+SIGNED_EVENTS = {0x02}
+
+ENTRY = re.compile(r'^l?([0-9A-F]{16})$')
+
+
+def decode(line):
+    match = ENTRY.match(line.strip())
+    if not match:
+        return None
+    data = bytes.fromhex(match.group(1))
+    sequence, event, day, hours, minutes, seconds = data[:6]
+    value = int.from_bytes(data[6:8], 'big', signed=event in SIGNED_EVENTS)
+    return [
+        sequence,
+        EVENTS.get(event, 'unknown_%02x' % event),
+        day,
+        '%02d:%02d:%02d' % (hours, minutes, seconds),
+        value,
+    ]
+
+
+def main(argv):
+    source = open(argv[1]) if len(argv) > 1 else sys.stdin
+    writer = csv.writer(sys.stdout)
+    writer.writerow(['sequence', 'event', 'day', 'time', 'value'])
+    for line in source:
+        row = decode(line)
+        if row:
+            writer.writerow(row)
+
+
+if __name__ == '__main__':
+    main(sys.argv)
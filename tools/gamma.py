@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+#
+#   Copyright 2012 Daniel A. Spilker
+#
+#   Licensed under the Apache License, Version 2.0 (the "License");
+#   you may not use this file except in compliance with the License.
+#   You may obtain a copy of the License at
+#
+#       http://www.apache.org/licenses/LICENSE-2.0
+#
+#   Unless required by applicable law or agreed to in writing, software
+#   distributed under the License is distributed on an "AS IS" BASIS,
+#   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#   See the License for the specific language governing permissions and
+#   limitations under the License.
+#
+
+"""Generates the gamma table of the firmware as a C header.
+
+Usage: gamma.py [EXPONENT [INPUT_BITS [OUTPUT_BITS]]]
+
+Entry i of the table is floor(2^OUTPUT_BITS * (i / (2^INPUT_BITS - 1))^EXPONENT),
+clipped to 2^OUTPUT_BITS - 1. The defaults 2.2, 8 and 12 give the table the
+firmware has always used.
+"""
+
+import sys
+
+
+def generate(exponent, input_bits, output_bits):
+    maximum = (1 << input_bits) - 1
+    limit = (1 << output_bits) - 1
+    return [min(limit, int((1 << output_bits) * (i / maximum) ** exponent)) for i in range(maximum + 1)]
+
+
+def main():
+    exponent_text = sys.argv[1] if len(sys.argv) > 1 else '2.2'
+    exponent = float(exponent_text)
+    input_bits = int(sys.argv[2]) if len(sys.argv) > 2 else 8
+    output_bits = int(sys.argv[3]) if len(sys.argv) > 3 else 12
+    values = generate(exponent, input_bits, output_bits)
+
+    print('/* Generated by tools/gamma.py %s %d %d, do not edit. */' % (exponent_text, input_bits, output_bits))
+    print('#define GAMMA_INPUT_BITS %d' % input_bits)
+    print('#define GAMMA_BITS %d' % output_bits)
+    print()
+    print('const uint16_t gammaValues[%d] PROGMEM = {' % len(values))
+    for value in values:
+        print('  %d,' % value)
+    print('};')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+#
+#   Copyright 2012 Daniel A. Spilker
+#
+#   Licensed under the Apache License, Version 2.0 (the "License");
+#   you may not use this file except in compliance with the License.
+#   You may obtain a copy of the License at
+#
+#       http://www.apache.org/licenses/LICENSE-2.0
+#
+#   Unless required by applicable law or agreed to in writing, software
+#   distributed under the License is distributed on an "AS IS" BASIS,
+#   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#   See the License for the specific language governing permissions and
+#   limitations under the License.
+#
+
+"""Reports the static RAM and the worst case stack depth of the firmware.
+
+Usage: memreport.py [--ram BYTES] [--headroom BYTES] [--callback NAME...]
+                    ELF SU...
+
+Lists every .data and .bss symbol of ELF by size. The stack depth of each
+function is the larger of the -fstack-usage figure from SU and the estimate
+from its prologue. LTO builds and the library have no usable SU entries, so
+the estimate alone is used there. The call graph is read from the
+disassembly. Indirect calls are assumed to reach the deepest of the
+functions given with --callback.
+
+ISRs do not nest, so the worst case is the deepest path from main plus the
+deepest ISR. Exits with 1 when less than --headroom bytes of RAM are left.
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+RETURN_ADDRESS = 2
+
+SYMBOL = re.compile(r'^[0-9a-f]+ <([^>]+)>:$')
+INSTRUCTION = re.compile(r'^\s+[0-9a-f]+:\t(?:[0-9a-f]{2} )+\s*\t(\S+)\s*([^;]*)(?:;.*<([^>]+)>)?')
+FRAME = re.compile(r'^(?:sbiw|subi)\s+r28, (?:lo8\()?(0x[0-9a-fA-F]+|\d+)')
+
+
+def run(*command):
+    return subprocess.run(command, check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout
+
+
+def read_symbols(elf):
+    symbols = []
+    for line in run('avr-nm', '-S', '--size-sort', elf).splitlines():
+        fields = line.split()
+        if len(fields) == 4 and fields[2] in 'bBdD':
+            section = '.bss' if fields[2] in 'bB' else '.data'
+            symbols.append((int(fields[1], 16), section, fields[3]))
+    return sorted(symbols, reverse=True)
+
+
+def read_stack_usage(files):
+    usage = {}
+    for name in files:
+        if not os.path.exists(name):
+            continue
+        with open(name) as file:
+            for line in file:
+                location, size, kind = line.rstrip('\n').split('\t')
+                function = location.split(':')[-1]
+                usage[function] = max(usage.get(function, 0), int(size))
+                if kind != 'static':
+                    print('warning: %s has %s stack usage' % (function, kind), file=sys.stderr)
+    return usage
+
+
+def read_call_graph(elf):
+    calls = {}
+    frames = {}
+    indirect = set()
+    current = None
+    for line in run('avr-objdump', '-d', elf).splitlines():
+        match = SYMBOL.match(line)
+        if match:
+            current = match.group(1)
+            calls[current] = set()
+            frames[current] = 0
+            continue
+        match = INSTRUCTION.match(line)
+        if not match or current is None:
+            continue
+        mnemonic, operands, target = match.groups()
+        if mnemonic in ('call', 'rcall', 'jmp', 'rjmp') and target and target != current and '+' not in target:
+            calls[current].add(target)
+        elif mnemonic in ('icall', 'ijmp'):
+            indirect.add(current)
+        elif mnemonic == 'push':
+            frames[current] += 1
+        else:
+            frame = FRAME.match(mnemonic + ' ' + operands)
+            if frame:
+                frames[current] += int(frame.group(1), 0)
+    return calls, frames, indirect
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--ram', type=int, default=1024)
+    parser.add_argument('--headroom', type=int, default=64)
+    parser.add_argument('--callback', action='append', default=[])
+    parser.add_argument('elf')
+    parser.add_argument('su', nargs='*')
+    args = parser.parse_args()
+
+    symbols = read_symbols(args.elf)
+    usage = read_stack_usage(args.su)
+    calls, frames, indirect = read_call_graph(args.elf)
+
+    def frame(function):
+        base = function.split('.')[0]
+        return max(usage.get(function, usage.get(base, 0)), frames.get(function, 0))
+
+    def resolve(function):
+        # LTO and IPA clones carry suffixes such as .lto_priv.0
+        if function not in calls:
+            for name in calls:
+                if name.split('.')[0] == function:
+                    return name
+        return function
+
+    depths = {}
+
+    def depth(function, path):
+        if function in path:
+            sys.exit('error: recursion %s' % ' -> '.join(path + [function]))
+        if function not in depths:
+            callees = set(calls.get(function, ()))
+            if function in indirect:
+                callees.update(resolve(callback) for callback in args.callback)
+            deepest = (0, [])
+            for callee in callees:
+                size, chain = depth(callee, path + [function])
+                deepest = max(deepest, (size + RETURN_ADDRESS, chain))
+            depths[function] = (frame(function) + deepest[0], [function] + deepest[1])
+        return depths[function]
+
+    print('size\tsection\tsymbol')
+    static = 0
+    for size, section, name in symbols:
+        print('%d\t%s\t%s' % (size, section, name))
+        static += size
+    print('%d\ttotal' % static)
+    print()
+
+    foreground, chain = depth('main', [])
+    foreground += RETURN_ADDRESS
+    print('stack\tentry\tpath')
+    print('%d\tmain\t%s' % (foreground, ' > '.join(chain)))
+    interrupt = (0, None)
+    for vector in sorted(name for name in calls if name.startswith('__vector_') and name != '__vector_default'):
+        size, chain = depth(vector, [])
+        size += RETURN_ADDRESS
+        print('%d\t%s\t%s' % (size, vector, ' > '.join(chain)))
+        interrupt = max(interrupt, (size, vector))
+    stack = foreground + interrupt[0]
+    print('%d\ttotal' % stack)
+    print()
+
+    headroom = args.ram - static - stack
+    print('ram %d, static %d, stack %d, headroom %d' % (args.ram, static, stack, headroom))
+    if headroom < args.headroom:
+        sys.exit('error: headroom below %d bytes' % args.headroom)
+
+
+if __name__ == '__main__':
+    main()
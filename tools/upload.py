@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+#
+#   Copyright 2012 Daniel A. Spilker
+#
+#   Licensed under the Apache License, Version 2.0 (the "License");
+#   you may not use this file except in compliance with the License.
+#   You may obtain a copy of the License at
+#
+#       http://www.apache.org/licenses/LICENSE-2.0
+#
+#   Unless required by applicable law or agreed to in writing, software
+#   distributed under the License is distributed on an "AS IS" BASIS,
+#   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#   See the License for the specific language governing permissions and
+#   limitations under the License.
+#
+
+"""Uploads a firmware image to the clock through its bootloader.
+
+Usage: upload.py [--baud BAUD] [--hold] PORT FILE
+
+FILE is the Intel HEX image of the application. The running firmware is
+asked to restart into the bootloader with the 'u' command at BAUD, the baud
+rate configured in the clock (9600 by default). With --hold, RXD is held low
+instead while the clock is reset by hand, which enters the bootloader even
+if the application does not answer. The image is then sent page by page at
+250000 baud and verified by the bootloader before it starts the new
+application. Requires pyserial.
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+import serial
+
+BOOT_BAUD = 250000
+PAGE_SIZE = 64
+PAGES = 0x1C00 // PAGE_SIZE
+
+SYNC = 0x1B
+ACK = 0x06
+NAK = 0x15
+
+FRAME_PAGE = ord('P')
+FRAME_END = ord('E')
+
+RETRIES = 3
+HOLD_TIME = 5
+
+# A clock in power-save mode loses the byte that wakes it. The empty lines
+# absorb it, so that the update command arrives as a line of its own.
+WAKE = b'\r\n\r\n'
+
+
+def crc16(data, crc=0xFFFF):
+    # same as _crc16_update from avr-libc
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+def read_hex(name):
+    image = bytearray()
+    base = 0
+    with open(name) as file:
+        for line in file:
+            line = line.strip()
+            if not line.startswith(':'):
+                continue
+            record = bytes.fromhex(line[1:])
+            if sum(record) & 0xFF:
+                raise ValueError('checksum error in %s' % line)
+            length, address, kind = record[0], record[1] << 8 | record[2], record[3]
+            data = record[4:4 + length]
+            if kind == 0x00:
+                address += base
+                if len(image) < address + length:
+                    image.extend(b'\xff' * (address + length - len(image)))
+                image[address:address + length] = data
+            elif kind == 0x02:
+                base = (data[0] << 8 | data[1]) << 4
+            elif kind == 0x01:
+                break
+    image.extend(b'\xff' * (-len(image) % PAGE_SIZE))
+    if len(image) > PAGES * PAGE_SIZE:
+        raise ValueError('image does not fit below the bootloader')
+    return bytes(image)
+
+
+def frame(kind, page, data):
+    body = struct.pack('<BB', kind, page) + data.ljust(PAGE_SIZE, b'\x00')
+    return body + struct.pack('<H', crc16(body))
+
+
+def sync(port):
+    deadline = time.time() + 10
+    while time.time() < deadline:
+        port.write(bytes([SYNC]))
+        if port.read(1) == bytes([ACK]):
+            time.sleep(0.1)
+            port.reset_input_buffer()
+            return
+    raise IOError('no answer from the bootloader')
+
+
+def send(port, data):
+    for _ in range(RETRIES):
+        port.write(data)
+        answer = port.read(1)
+        if answer == bytes([ACK]):
+            return
+    raise IOError('frame rejected')
+
+
+def upload(port, image):
+    """Sends the image to the bootloader and returns the time it took."""
+    pages = len(image) // PAGE_SIZE
+    sync(port)
+    port.timeout = 1
+    start = time.time()
+    for page in range(pages):
+        send(port, frame(FRAME_PAGE, page, image[page * PAGE_SIZE:(page + 1) * PAGE_SIZE]))
+        print('\rpage %d/%d' % (page + 1, pages), end='', file=sys.stderr)
+    send(port, frame(FRAME_END, pages, struct.pack('<H', crc16(image))))
+    return time.time() - start
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--baud', type=int, default=9600)
+    parser.add_argument('--hold', action='store_true')
+    parser.add_argument('port')
+    parser.add_argument('file')
+    args = parser.parse_args()
+
+    image = read_hex(args.file)
+
+    if args.hold:
+        with serial.Serial(args.port, BOOT_BAUD) as port:
+            port.break_condition = True
+            print('reset the clock within %d s' % HOLD_TIME, file=sys.stderr)
+            time.sleep(HOLD_TIME)
+            port.break_condition = False
+    else:
+        with serial.Serial(args.port, args.baud, timeout=0.5) as port:
+            port.write(WAKE + b'u\r\n')
+            port.flush()
+    with serial.Serial(args.port, BOOT_BAUD, timeout=0.1) as port:
+        time.sleep(0.05)
+        port.reset_input_buffer()
+        elapsed = upload(port, image)
+
+    print('\n%d bytes in %.2f s, %.0f ms/KB' % (len(image), elapsed, elapsed * 1024000 / len(image)), file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()